@@ -0,0 +1,154 @@
+/*
+ * Microbenchmark for k-way merges of sorted runs, as done by compaction
+ * and range queries: the loser tree in MergeContext against the binary
+ * heap of merge entries it replaced, for 2 to 64 inputs.
+ *
+ * Usage: bench_merge [total number of entries]
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <queue>
+#include <random>
+#include <vector>
+
+#include "merge.h"
+
+using namespace std;
+
+#define DEFAULT_NUM_ENTRIES 4000000
+
+/*
+ * The previous merge: a priority queue of inputs, popped and pushed
+ * back once for every entry taken
+ */
+
+struct heap_entry {
+    int precedence;
+    const entry_t *entries;
+    long num_entries;
+    int current_index = 0;
+    entry_t head(void) const {return entries[current_index];}
+    bool done(void) const {return current_index == num_entries;}
+    bool operator>(const heap_entry& other) const {
+        if (head() == other.head()) {
+            return precedence > other.precedence;
+        } else {
+            return head() > other.head();
+        }
+    }
+};
+
+class HeapMerge {
+    priority_queue<heap_entry, vector<heap_entry>, greater<heap_entry>> queue;
+public:
+    void add(const entry_t *entries, long num_entries) {
+        heap_entry merge_entry;
+
+        merge_entry.entries = entries;
+        merge_entry.num_entries = num_entries;
+        merge_entry.precedence = queue.size();
+        queue.push(merge_entry);
+    }
+
+    entry_t next(void) {
+        heap_entry current, next;
+
+        current = queue.top();
+        next = current;
+
+        while (next.head().key == current.head().key && !queue.empty()) {
+            queue.pop();
+
+            next.current_index++;
+            if (!next.done()) queue.push(next);
+
+            next = queue.top();
+        }
+
+        return current.head();
+    }
+
+    bool done(void) {return queue.empty();}
+};
+
+/*
+ * Split num_entries random entries over k sorted runs with unique keys.
+ * Keys are drawn from twice as many values as there are entries, so
+ * that the runs overlap the way they do in a tree.
+ */
+
+static vector<vector<entry_t>> make_inputs(int k, long num_entries, mt19937& rng) {
+    vector<vector<entry_t>> inputs(k);
+    entry_t entry;
+    long i;
+
+    for (auto& input : inputs) {
+        for (i = 0; i < num_entries / k; i++) {
+            entry.key = rng() % (2 * num_entries);
+            entry.val = i;
+            input.push_back(entry);
+        }
+
+        sort(input.begin(), input.end());
+        input.erase(unique(input.begin(), input.end()), input.end());
+    }
+
+    return inputs;
+}
+
+int main(int argc, char *argv[]) {
+    int input_counts[] = {2, 4, 8, 16, 32, 64};
+    chrono::time_point<chrono::steady_clock> start;
+    vector<vector<entry_t>> inputs;
+    vector<entry_t> heap_output, tree_output;
+    entry_t batch[MERGE_BATCH_SIZE];
+    mt19937 rng(265);
+    double heap_ms, tree_ms;
+    long num_entries, batch_size;
+
+    num_entries = (argc > 1) ? atol(argv[1]) : DEFAULT_NUM_ENTRIES;
+
+    printf("%-8s %16s %16s %10s\n", "inputs", "heap (ms)", "loser tree (ms)", "speedup");
+
+    for (int k : input_counts) {
+        HeapMerge heap;
+        MergeContext tree;
+
+        inputs = make_inputs(k, num_entries, rng);
+        heap_output.clear();
+        tree_output.clear();
+
+        for (const auto& input : inputs) heap.add(input.data(), input.size());
+        start = chrono::steady_clock::now();
+
+        while (!heap.done()) {
+            heap_output.push_back(heap.next());
+        }
+
+        heap_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        for (const auto& input : inputs) tree.add(input.data(), input.size());
+        start = chrono::steady_clock::now();
+
+        while ((batch_size = tree.next(batch, MERGE_BATCH_SIZE)) > 0) {
+            tree_output.insert(tree_output.end(), batch, batch + batch_size);
+        }
+
+        tree_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        if (heap_output.size() != tree_output.size()
+            || !equal(heap_output.begin(), heap_output.end(), tree_output.begin(),
+                      [](const entry_t& a, const entry_t& b) {return a.key == b.key && a.val == b.val;})) {
+            fprintf(stderr, "Merges with %d inputs differ\n", k);
+            return EXIT_FAILURE;
+        }
+
+        printf("%-8d %16.1f %16.1f %9.1fx\n", k, heap_ms, tree_ms, heap_ms / tree_ms);
+    }
+
+    return 0;
+}
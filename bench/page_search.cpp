@@ -0,0 +1,129 @@
+/*
+ * Microbenchmark for searching within a run page: the original linear
+ * scan over the whole page, a linear scan that stops early, the
+ * branchless binary search used by Run::get, and std::lower_bound.
+ *
+ * Usage: bench_page_search [number of lookups]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "page_search.h"
+
+using namespace std;
+
+#define DEFAULT_NUM_LOOKUPS 10000000
+#define NUM_PAGES 256
+
+typedef const entry_t * (*search_fn)(const entry_t *, long, KEY_t);
+
+static const entry_t * linear_scan(const entry_t *page, long num_entries, KEY_t key) {
+    const entry_t *found;
+    long i;
+
+    found = nullptr;
+
+    for (i = 0; i < num_entries; i++) {
+        if (page[i].key == key) found = &page[i];
+    }
+
+    return found;
+}
+
+static const entry_t * linear_early_exit(const entry_t *page, long num_entries, KEY_t key) {
+    long i;
+
+    for (i = 0; i < num_entries && page[i].key <= key; i++) {
+        if (page[i].key == key) return &page[i];
+    }
+
+    return nullptr;
+}
+
+static const entry_t * std_lower_bound(const entry_t *page, long num_entries, KEY_t key) {
+    const entry_t *entry;
+    entry_t search_entry;
+
+    search_entry.key = key;
+    entry = lower_bound(page, page + num_entries, search_entry);
+
+    return (entry < page + num_entries && entry->key == key) ? entry : nullptr;
+}
+
+static double run(search_fn search, const vector<entry_t>& pages, long page_entries,
+                  const vector<KEY_t>& keys, const vector<long>& page_indexes, long& found) {
+    chrono::time_point<chrono::steady_clock> start, end;
+    size_t i;
+
+    found = 0;
+    start = chrono::steady_clock::now();
+
+    for (i = 0; i < keys.size(); i++) {
+        found += (search(&pages[page_indexes[i] * page_entries], page_entries, keys[i]) != nullptr);
+    }
+
+    end = chrono::steady_clock::now();
+
+    return chrono::duration<double, nano>(end - start).count() / keys.size();
+}
+
+int main(int argc, char *argv[]) {
+    long page_sizes[] = {4096, 16384, 65536};
+    const char *names[] = {"linear scan", "linear, early exit", "branchless binary", "std::lower_bound"};
+    search_fn searches[] = {linear_scan, linear_early_exit, page_find, std_lower_bound};
+    vector<entry_t> pages;
+    vector<KEY_t> keys;
+    vector<long> page_indexes;
+    mt19937 rng(265);
+    long num_lookups, page_entries, found, expected, i, j;
+    double ns;
+
+    num_lookups = (argc > 1) ? atol(argv[1]) : DEFAULT_NUM_LOOKUPS;
+
+    printf("%-10s %-20s %12s\n", "page size", "search", "ns/lookup");
+
+    for (long page_size : page_sizes) {
+        page_entries = page_size / sizeof(entry_t);
+
+        /*
+         * Fill NUM_PAGES sorted pages with even keys, so that odd keys
+         * miss, then look up a mix of hits and misses on random pages
+         */
+
+        pages.resize(NUM_PAGES * page_entries);
+
+        for (i = 0; i < (long)pages.size(); i++) {
+            pages[i].key = 2 * i;
+            pages[i].val = i;
+        }
+
+        keys.resize(num_lookups);
+        page_indexes.resize(num_lookups);
+
+        for (i = 0; i < num_lookups; i++) {
+            page_indexes[i] = rng() % NUM_PAGES;
+            keys[i] = 2 * (page_indexes[i] * page_entries + rng() % page_entries) + rng() % 2;
+        }
+
+        expected = -1;
+
+        for (j = 0; j < 4; j++) {
+            ns = run(searches[j], pages, page_entries, keys, page_indexes, found);
+
+            if (expected >= 0 && found != expected) {
+                fprintf(stderr, "%s found %ld keys, expected %ld\n", names[j], found, expected);
+                return EXIT_FAILURE;
+            }
+
+            expected = found;
+            printf("%-10ld %-20s %12.1f\n", page_size, names[j], ns);
+        }
+    }
+
+    return 0;
+}
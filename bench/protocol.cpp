@@ -0,0 +1,310 @@
+/*
+ * Benchmark for the command loops, on workloads in the text format of
+ * the tests: the iostream loop that parsed a command at a time with
+ * operator>> and flushed after every result, against the text loop on
+ * buffered input and output, and the binary protocol with a request
+ * per command, or with consecutive commands of a kind batched into one
+ * request. Each workload is repeated to make it long enough to time,
+ * and output goes to /dev/null.
+ *
+ * Usage: bench_protocol [repetitions] [workload ...]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <glob.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "lsm_tree.h"
+#include "protocol.h"
+
+using namespace std;
+
+#define DEFAULT_REPETITIONS 100
+#define DEFAULT_WORKLOADS "test/test-*/in"
+#define INPUT_PATH "/tmp/bench_protocol.in"
+
+// Binary requests batch at most this many consecutive commands
+#define BATCH_MAX_COMMANDS 1024
+
+/*
+ * The command loop before buffered input and output
+ */
+
+static void iostream_command_loop(LSMTree& tree, istream& in, ostream& out) {
+    char command;
+    KEY_t key_a, key_b;
+    VAL_t val;
+    string file_path, line;
+    istringstream line_stream;
+    vector<KEY_t> keys;
+    vector<VAL_t> vals;
+    unique_ptr<bool[]> found;
+    unique_ptr<RangeIterator> it;
+    bool first;
+
+    while (in >> command) {
+        switch (command) {
+        case 'p':
+            in >> key_a >> val;
+            tree.put(key_a, val);
+            break;
+        case 'g':
+            in >> key_a;
+            if (tree.get(key_a, val)) out << val;
+            out << endl;
+            break;
+        case 'm':
+            getline(in, line);
+            line_stream.clear();
+            line_stream.str(line);
+            keys.clear();
+
+            while (line_stream >> key_a) keys.push_back(key_a);
+
+            vals.resize(keys.size());
+            found.reset(new bool[keys.size()]);
+            tree.multi_get(keys.data(), keys.size(), vals.data(), found.get());
+
+            for (size_t i = 0; i < keys.size(); i++) {
+                if (found[i]) out << vals[i];
+                out << endl;
+            }
+
+            break;
+        case 'r':
+            in >> key_a >> key_b;
+            first = true;
+
+            if (key_a < key_b) {
+                it = tree.iterator();
+                it->set_upper_bound(key_b);
+
+                for (it->seek(key_a); it->valid(); it->next()) {
+                    if (!first) out << " ";
+                    out << it->entry().key << ":" << it->entry().val;
+                    first = false;
+                }
+            }
+
+            out << endl;
+            break;
+        case 'd':
+            in >> key_a;
+            tree.del(key_a);
+            break;
+        case 'l':
+            in.ignore();
+            getline(in, file_path);
+            tree.load(file_path.substr(1, file_path.size() - 2));
+            break;
+        }
+    }
+}
+
+/*
+ * Translate a text workload into binary requests, batching up to the
+ * given number of consecutive commands of a kind into each. Multi-gets
+ * become a request of their own.
+ */
+
+static string to_binary(const string& text, size_t batch_max) {
+    istringstream in(text), line_stream;
+    protocol_header_t header;
+    vector<KEY_t> items;
+    string binary, line, file_path;
+    char command, batched;
+    long a, b;
+
+    memset(&header, 0, sizeof(header));
+    batched = 0;
+
+    auto item_count = [&] {
+        return (batched == OP_PUT || batched == OP_RANGE) ? items.size() / 2 : items.size();
+    };
+
+    auto end_batch = [&] {
+        if (batched == 0) return;
+
+        header.op = batched;
+        header.count = item_count();
+        binary.append((const char *)&header, sizeof(header));
+        binary.append((const char *)items.data(), items.size() * sizeof(KEY_t));
+
+        items.clear();
+        batched = 0;
+    };
+
+    while (in >> command) {
+        if (command != batched) end_batch();
+
+        switch (command) {
+        case 'p':
+        case 'r':
+            in >> a >> b;
+            items.push_back(a);
+            items.push_back(b);
+            break;
+        case 'g':
+        case 'd':
+            in >> a;
+            items.push_back(a);
+            break;
+        case 'm':
+            getline(in, line);
+            line_stream.clear();
+            line_stream.str(line);
+
+            while (line_stream >> a) items.push_back(a);
+
+            batched = OP_GET;
+            end_batch();
+            continue;
+        case 'l':
+            in.ignore();
+            getline(in, file_path);
+            file_path = file_path.substr(1, file_path.size() - 2);
+
+            header.op = OP_LOAD;
+            header.count = file_path.size();
+            binary.append((const char *)&header, sizeof(header));
+            binary.append(file_path);
+            continue;
+        default:
+            // Stats have no request
+            continue;
+        }
+
+        batched = command;
+        if (item_count() >= batch_max) end_batch();
+    }
+
+    end_batch();
+
+    return binary;
+}
+
+/*
+ * Time a command loop over the input, on a fresh tree
+ */
+
+static double time_loop(const string& input, function<void(LSMTree&, int)> loop) {
+    chrono::time_point<chrono::steady_clock> start;
+    double ms;
+    int fd;
+
+    FILE *file = fopen(INPUT_PATH, "w");
+    fwrite(input.data(), 1, input.size(), file);
+    fclose(file);
+
+    fd = open(INPUT_PATH, O_RDONLY);
+
+    {
+        LSMTree tree(DEFAULT_BUFFER_NUM_PAGES * getpagesize() / sizeof(entry_t),
+                     DEFAULT_TREE_DEPTH, DEFAULT_TREE_FANOUT, DEFAULT_THREAD_COUNT,
+                     DEFAULT_COMPACTION_THREAD_COUNT, DEFAULT_PIN_THREADS,
+                     DEFAULT_BF_BITS_PER_ENTRY, DEFAULT_FILTER_ALLOCATION, DEFAULT_MERGE_POLICY,
+                     DEFAULT_CACHE_NUM_PAGES * getpagesize(), DEFAULT_EVICTION_POLICY,
+                     {DEFAULT_PAGE_SIZE}, DEFAULT_RUN_WRITE_FLAGS, "", "", WAL_NONE,
+                     DEFAULT_MERGE_PARTITION_MIN_ENTRIES, DEFAULT_GET_PARALLEL_MIN_PAGES);
+
+        start = chrono::steady_clock::now();
+        loop(tree, fd);
+        ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+
+    close(fd);
+    unlink(INPUT_PATH);
+
+    return ms;
+}
+
+int main(int argc, char *argv[]) {
+    vector<string> workloads;
+    string text, repeated, directory;
+    glob_t matches;
+    long num_commands;
+    int repetitions, i;
+    double ms;
+    char cwd[4096];
+
+    repetitions = (argc > 1) ? atoi(argv[1]) : DEFAULT_REPETITIONS;
+
+    for (i = 2; i < argc; i++) workloads.push_back(argv[i]);
+
+    if (workloads.empty() && glob(DEFAULT_WORKLOADS, 0, nullptr, &matches) == 0) {
+        workloads.assign(matches.gl_pathv, matches.gl_pathv + matches.gl_pathc);
+        globfree(&matches);
+    }
+
+    if (getcwd(cwd, sizeof(cwd)) == nullptr) return EXIT_FAILURE;
+
+    printf("%-20s %10s %-16s %12s %16s\n", "workload", "commands", "loop", "time (ms)", "K commands/s");
+
+    for (const auto& workload : workloads) {
+        ifstream stream(workload);
+        stringstream contents;
+
+        contents << stream.rdbuf();
+        text = contents.str();
+        if (!text.empty() && text.back() != '\n') text += '\n';
+
+        repeated.clear();
+        for (i = 0; i < repetitions; i++) repeated += text;
+
+        num_commands = count(repeated.begin(), repeated.end(), '\n');
+
+        // Loads name files relative to the workload
+        directory = workload.substr(0, workload.find_last_of('/') + 1);
+        if (!directory.empty() && chdir(directory.c_str()) != 0) continue;
+
+        auto report = [&](const char *name, double ms) {
+            printf("%-20s %10ld %-16s %12.1f %16.1f\n", workload.c_str(), num_commands, name, ms,
+                   num_commands / ms);
+        };
+
+        ms = time_loop(repeated, [](LSMTree& tree, int fd) {
+            ifstream in(INPUT_PATH);
+            ofstream out("/dev/null");
+
+            iostream_command_loop(tree, in, out);
+        });
+        report("iostream", ms);
+
+        ms = time_loop(repeated, [](LSMTree& tree, int fd) {
+            FILE *file = fopen("/dev/null", "w");
+            InputBuffer in(fd);
+            OutputBuffer out(file);
+
+            text_command_loop(tree, in, out);
+            fclose(file);
+        });
+        report("text", ms);
+
+        for (int batch_max : {1, BATCH_MAX_COMMANDS}) {
+            ms = time_loop(to_binary(repeated, batch_max), [](LSMTree& tree, int fd) {
+                FILE *file = fopen("/dev/null", "w");
+                InputBuffer in(fd);
+                OutputBuffer out(file);
+
+                binary_command_loop(tree, in, out);
+                fclose(file);
+            });
+            report(batch_max == 1 ? "binary" : "binary, batched", ms);
+        }
+
+        if (chdir(cwd) != 0) return EXIT_FAILURE;
+    }
+
+    return 0;
+}
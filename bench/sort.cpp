@@ -0,0 +1,150 @@
+/*
+ * Benchmark for sorting batches of entries by key while keeping the
+ * last entry for each key, as a bulk load does: the radix sort on 1 to
+ * 8 threads, against a stable comparison sort, and against inserting
+ * into a std::set, as the buffer once did. std::sort is shown for
+ * reference only, since it is not stable and so cannot tell which entry
+ * for a key came last.
+ *
+ * Keys are drawn either from the whole key space, or from a quarter as
+ * many values as there are entries, so that most keys repeat.
+ *
+ * Usage: bench_sort [number of entries ...]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "radix_sort.h"
+
+using namespace std;
+
+// Inserting into a set is only timed up to this many entries
+#define SET_MAX_ENTRIES 10000000
+
+static long keep_last(vector<entry_t>& entries) {
+    size_t i;
+    long kept;
+
+    kept = 0;
+
+    for (i = 0; i < entries.size(); i++) {
+        if (i + 1 == entries.size() || entries[i + 1].key != entries[i].key) {
+            entries[kept++] = entries[i];
+        }
+    }
+
+    return kept;
+}
+
+static long set_sort(vector<entry_t>& entries) {
+    set<entry_t> sorted;
+    long i;
+
+    for (const auto& entry : entries) {
+        auto inserted = sorted.insert(entry);
+
+        if (!inserted.second) {
+            sorted.erase(inserted.first);
+            sorted.insert(entry);
+        }
+    }
+
+    i = 0;
+    for (const auto& entry : sorted) entries[i++] = entry;
+
+    return sorted.size();
+}
+
+static double time_ms(function<void(void)> f) {
+    chrono::time_point<chrono::steady_clock> start;
+
+    start = chrono::steady_clock::now();
+    f();
+
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]) {
+    vector<long> sizes = {1000000, 10000000};
+    int thread_counts[] = {1, 2, 4, 8};
+    vector<entry_t> input, expected, entries, scratch;
+    mt19937 rng(265);
+    long expected_size, size;
+    double ms;
+    int i;
+
+    if (argc > 1) {
+        sizes.clear();
+        for (i = 1; i < argc; i++) sizes.push_back(atol(argv[i]));
+    }
+
+    printf("%-12s %-10s %-16s %12s %14s\n", "entries", "keys", "sort", "time (ms)", "M entries/s");
+
+    auto report = [&](long num_entries, const char *keys, const char *name, double ms) {
+        printf("%-12ld %-10s %-16s %12.1f %14.1f\n", num_entries, keys, name, ms, num_entries / ms / 1000);
+    };
+
+    for (long num_entries : sizes) {
+        for (bool repeated : {false, true}) {
+            const char *keys = repeated ? "repeated" : "unique";
+
+            input.resize(num_entries);
+
+            for (i = 0; i < num_entries; i++) {
+                input[i].key = repeated ? rng() % max(1L, num_entries / 4) : rng();
+                input[i].val = i;
+            }
+
+            expected = input;
+            ms = time_ms([&] {
+                stable_sort(expected.begin(), expected.end());
+                expected_size = keep_last(expected);
+            });
+            report(num_entries, keys, "stable_sort", ms);
+
+            entries = input;
+            ms = time_ms([&] {sort(entries.begin(), entries.end());});
+            report(num_entries, keys, "std::sort", ms);
+
+            if (num_entries <= SET_MAX_ENTRIES) {
+                entries = input;
+                ms = time_ms([&] {size = set_sort(entries);});
+                report(num_entries, keys, "std::set", ms);
+            }
+
+            // Fault in the memory the radix sorts use before timing them
+            scratch.assign(num_entries, entry_t());
+            entries = input;
+            radix_sort(entries.data(), num_entries, scratch.data());
+
+            for (int num_threads : thread_counts) {
+                Scheduler scheduler(num_threads);
+                char name[32];
+
+                entries = input;
+                ms = time_ms([&] {
+                    size = radix_sort(entries.data(), num_entries, scratch.data(), &scheduler);
+                });
+
+                if (size != expected_size
+                    || !equal(entries.begin(), entries.begin() + size, expected.begin(),
+                              [](const entry_t& a, const entry_t& b) {return a.key == b.key && a.val == b.val;})) {
+                    fprintf(stderr, "Radix sort on %d threads differs\n", num_threads);
+                    return EXIT_FAILURE;
+                }
+
+                snprintf(name, sizeof(name), "radix, %d thr", num_threads);
+                report(num_entries, keys, name, ms);
+            }
+        }
+    }
+
+    return 0;
+}
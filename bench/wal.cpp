@@ -0,0 +1,127 @@
+/*
+ * Benchmark for the cost of the write-ahead log: put throughput and
+ * latency with the log in each of its durability modes, against the
+ * tree without a log, for 1 to 8 writer threads. Each configuration
+ * runs for a fixed time, since per-batch durability is bound by how
+ * fast the disk syncs.
+ *
+ * Usage: bench_wal [seconds per configuration] [log file]
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "lsm_tree.h"
+
+using namespace std;
+
+#define DEFAULT_SECONDS 1.0
+#define DEFAULT_LOG_PATH "/tmp/bench_wal.log"
+
+struct config {
+    const char *name;
+    bool logged;
+    wal_durability durability;
+};
+
+/*
+ * Run writers putting random keys until the time is up, and collect
+ * the latency of every put, in microseconds
+ */
+
+static vector<double> run_writers(LSMTree& tree, int num_writers, double seconds) {
+    vector<vector<double>> latencies(num_writers);
+    vector<thread> writers;
+    vector<double> all;
+    atomic<bool> stop(false);
+    int i;
+
+    for (i = 0; i < num_writers; i++) {
+        writers.emplace_back([&tree, &latencies, &stop, i] {
+            chrono::time_point<chrono::steady_clock> start;
+            uint32_t x;
+
+            x = 2654435761u * (i + 1);
+
+            while (!stop.load(memory_order_relaxed)) {
+                // xorshift32
+                x ^= x << 13;
+                x ^= x >> 17;
+                x ^= x << 5;
+
+                start = chrono::steady_clock::now();
+                tree.put((KEY_t)x, (VAL_t)(x & 0xffff));
+                latencies[i].push_back(
+                    chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+            }
+        });
+    }
+
+    this_thread::sleep_for(chrono::duration<double>(seconds));
+    stop = true;
+
+    for (auto& writer : writers) writer.join();
+    for (const auto& thread_latencies : latencies) {
+        all.insert(all.end(), thread_latencies.begin(), thread_latencies.end());
+    }
+
+    return all;
+}
+
+int main(int argc, char *argv[]) {
+    config configs[] = {
+        {"no log", false, WAL_NONE},
+        {"none", true, WAL_NONE},
+        {"periodic", true, WAL_PERIODIC},
+        {"batch", true, WAL_PER_BATCH},
+    };
+    int writer_counts[] = {1, 2, 4, 8};
+    vector<double> latencies;
+    const char *log_path;
+    double seconds, mean;
+    long buffer_max_entries;
+
+    seconds = (argc > 1) ? atof(argv[1]) : DEFAULT_SECONDS;
+    log_path = (argc > 2) ? argv[2] : DEFAULT_LOG_PATH;
+    buffer_max_entries = DEFAULT_BUFFER_NUM_PAGES * getpagesize() / sizeof(entry_t);
+
+    printf("%-10s %8s %14s %14s %14s\n", "log", "writers", "puts/s", "mean (us)", "p99 (us)");
+
+    for (const auto& config : configs) {
+        for (int num_writers : writer_counts) {
+            unlink(log_path);
+
+            {
+                LSMTree tree(buffer_max_entries, DEFAULT_TREE_DEPTH, DEFAULT_TREE_FANOUT,
+                             DEFAULT_THREAD_COUNT, DEFAULT_COMPACTION_THREAD_COUNT,
+                             DEFAULT_PIN_THREADS, DEFAULT_BF_BITS_PER_ENTRY,
+                             DEFAULT_FILTER_ALLOCATION, DEFAULT_MERGE_POLICY,
+                             DEFAULT_CACHE_NUM_PAGES * getpagesize(), DEFAULT_EVICTION_POLICY,
+                             {DEFAULT_PAGE_SIZE}, DEFAULT_RUN_WRITE_FLAGS,
+                             "", config.logged ? log_path : "", config.durability,
+                             DEFAULT_MERGE_PARTITION_MIN_ENTRIES, DEFAULT_GET_PARALLEL_MIN_PAGES);
+
+                latencies = run_writers(tree, num_writers, seconds);
+            }
+
+            mean = 0;
+            for (double latency : latencies) mean += latency;
+            mean /= latencies.size();
+
+            sort(latencies.begin(), latencies.end());
+
+            printf("%-10s %8d %14.0f %14.2f %14.2f\n", config.name, num_writers,
+                   latencies.size() / seconds, mean, latencies[latencies.size() * 99 / 100]);
+        }
+    }
+
+    unlink(log_path);
+
+    return 0;
+}
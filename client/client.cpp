@@ -0,0 +1,293 @@
+/*
+ * Load generator for the server: a number of connections, each on a
+ * thread of its own, send put and get requests of random keys, keeping
+ * up to a given number of requests in flight on each, for a fixed time.
+ * Reports the throughput in requests and in keys, and the latency of
+ * requests from being sent to being answered.
+ *
+ * Usage: client (-s socket path | -S port) [-c connections]
+ *               [-d requests in flight per connection] [-k keys per request]
+ *               [-g fraction of requests that are gets] [-n number of distinct keys]
+ *               [-t seconds]
+ */
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "protocol.h"
+
+using namespace std;
+
+#define DEFAULT_CONNECTIONS 4
+#define DEFAULT_DEPTH 16
+#define DEFAULT_KEYS_PER_REQUEST 1
+#define DEFAULT_GET_FRACTION 0.5
+#define DEFAULT_NUM_KEYS 1000000
+#define DEFAULT_SECONDS 5.0
+
+typedef chrono::steady_clock::time_point time_point_t;
+
+struct options {
+    string socket_path;
+    int port;
+    int num_connections;
+    int depth;
+    int keys_per_request;
+    double get_fraction;
+    long num_keys;
+    double seconds;
+};
+
+typedef struct options options_t;
+
+struct client_stats {
+    long requests, keys;
+    vector<double> latencies;
+};
+
+typedef struct client_stats client_stats_t;
+
+static void fail(const string& message) {
+    fprintf(stderr, "%s\n", message.c_str());
+    exit(EXIT_FAILURE);
+}
+
+static int connect_to_server(const options_t& options) {
+    struct sockaddr_un unix_address;
+    struct sockaddr_in tcp_address;
+    int fd, result, enable;
+
+    if (!options.socket_path.empty()) {
+        memset(&unix_address, 0, sizeof(unix_address));
+        unix_address.sun_family = AF_UNIX;
+        strncpy(unix_address.sun_path, options.socket_path.c_str(), sizeof(unix_address.sun_path) - 1);
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        result = connect(fd, (struct sockaddr *)&unix_address, sizeof(unix_address));
+    } else {
+        memset(&tcp_address, 0, sizeof(tcp_address));
+        tcp_address.sin_family = AF_INET;
+        tcp_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        tcp_address.sin_port = htons(options.port);
+
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        result = connect(fd, (struct sockaddr *)&tcp_address, sizeof(tcp_address));
+
+        enable = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    }
+
+    if (fd == -1 || result != 0) fail("Could not connect to the server.");
+
+    return fd;
+}
+
+static void write_fully(int fd, const void *data, size_t length) {
+    ssize_t result;
+    size_t done;
+
+    for (done = 0; done < length; done += result) {
+        if ((result = write(fd, (const char *)data + done, length - done)) <= 0) {
+            fail("Lost the connection to the server.");
+        }
+    }
+}
+
+static void read_fully(int fd, void *data, size_t length) {
+    ssize_t result;
+    size_t done;
+
+    for (done = 0; done < length; done += result) {
+        if ((result = read(fd, (char *)data + done, length - done)) <= 0) {
+            fail("Lost the connection to the server.");
+        }
+    }
+}
+
+/*
+ * Drive one connection until the time is up, then wait for the answers
+ * to the requests still in flight
+ */
+
+static void run_connection(const options_t& options, int index, atomic<bool>& stop,
+                           client_stats_t& stats) {
+    deque<time_point_t> sent;
+    protocol_header_t header;
+    vector<entry_t> entries;
+    vector<KEY_t> keys;
+    vector<char> payload;
+    uint64_t x;
+    int fd, i;
+
+    fd = connect_to_server(options);
+    x = 0x9e3779b97f4a7c15ULL * (index + 1);
+
+    auto random = [&x] {
+        // xorshift64
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        return x;
+    };
+
+    memset(&header, 0, sizeof(header));
+    entries.resize(options.keys_per_request);
+    keys.resize(options.keys_per_request);
+
+    auto send_request = [&] {
+        header.count = options.keys_per_request;
+
+        if (random() % 1000 < options.get_fraction * 1000) {
+            header.op = OP_GET;
+            for (auto& key : keys) key = random() % options.num_keys;
+
+            write_fully(fd, &header, sizeof(header));
+            write_fully(fd, keys.data(), keys.size() * sizeof(KEY_t));
+        } else {
+            header.op = OP_PUT;
+
+            for (auto& entry : entries) {
+                entry.key = random() % options.num_keys;
+                entry.val = entry.key;
+            }
+
+            write_fully(fd, &header, sizeof(header));
+            write_fully(fd, entries.data(), entries.size() * sizeof(entry_t));
+        }
+
+        sent.push_back(chrono::steady_clock::now());
+    };
+
+    auto read_response = [&] {
+        read_fully(fd, &header, sizeof(header));
+
+        if (header.status != PROTOCOL_OK) fail("The server rejected a request.");
+
+        if (header.op == OP_GET) {
+            payload.resize(header.count * sizeof(VAL_t));
+            read_fully(fd, payload.data(), payload.size());
+        }
+
+        stats.latencies.push_back(
+            chrono::duration<double, micro>(chrono::steady_clock::now() - sent.front()).count());
+        stats.requests++;
+        stats.keys += options.keys_per_request;
+        sent.pop_front();
+    };
+
+    for (i = 0; i < options.depth; i++) send_request();
+
+    while (!stop.load(memory_order_relaxed)) {
+        read_response();
+        send_request();
+    }
+
+    while (!sent.empty()) read_response();
+
+    close(fd);
+}
+
+int main(int argc, char *argv[]) {
+    vector<client_stats_t> stats;
+    vector<double> latencies;
+    vector<thread> connections;
+    atomic<bool> stop(false);
+    options_t options;
+    long requests, keys;
+    int opt, i;
+
+    options.port = 0;
+    options.num_connections = DEFAULT_CONNECTIONS;
+    options.depth = DEFAULT_DEPTH;
+    options.keys_per_request = DEFAULT_KEYS_PER_REQUEST;
+    options.get_fraction = DEFAULT_GET_FRACTION;
+    options.num_keys = DEFAULT_NUM_KEYS;
+    options.seconds = DEFAULT_SECONDS;
+
+    while ((opt = getopt(argc, argv, "s:S:c:d:k:g:n:t:")) != -1) {
+        switch (opt) {
+        case 's':
+            options.socket_path = optarg;
+            break;
+        case 'S':
+            options.port = atoi(optarg);
+            break;
+        case 'c':
+            options.num_connections = atoi(optarg);
+            break;
+        case 'd':
+            options.depth = atoi(optarg);
+            break;
+        case 'k':
+            options.keys_per_request = atoi(optarg);
+            break;
+        case 'g':
+            options.get_fraction = atof(optarg);
+            break;
+        case 'n':
+            options.num_keys = atol(optarg);
+            break;
+        case 't':
+            options.seconds = atof(optarg);
+            break;
+        default:
+            fail("Usage: " + string(argv[0]) + " (-s socket path | -S port) "
+                 "[-c connections] [-d requests in flight per connection] "
+                 "[-k keys per request] [-g fraction of requests that are gets] "
+                 "[-n number of distinct keys] [-t seconds]");
+        }
+    }
+
+    if (options.socket_path.empty() == (options.port == 0)) {
+        fail("Give either a socket path or a port.");
+    } else if (options.depth < 1 || options.keys_per_request < 1 || options.num_keys < 1) {
+        fail("Depth, keys per request and number of keys must be positive.");
+    }
+
+    stats.resize(options.num_connections);
+
+    for (i = 0; i < options.num_connections; i++) {
+        connections.emplace_back(run_connection, cref(options), i, ref(stop), ref(stats[i]));
+    }
+
+    this_thread::sleep_for(chrono::duration<double>(options.seconds));
+    stop = true;
+
+    for (auto& connection : connections) connection.join();
+
+    requests = 0;
+    keys = 0;
+
+    for (const auto& connection_stats : stats) {
+        requests += connection_stats.requests;
+        keys += connection_stats.keys;
+        latencies.insert(latencies.end(), connection_stats.latencies.begin(),
+                         connection_stats.latencies.end());
+    }
+
+    sort(latencies.begin(), latencies.end());
+
+    printf("%ld requests, %.0f requests/s, %.0f keys/s\n", requests, requests / options.seconds,
+           keys / options.seconds);
+
+    if (!latencies.empty()) {
+        printf("latency (us): p50 %.1f, p99 %.1f, max %.1f\n", latencies[latencies.size() / 2],
+               latencies[latencies.size() * 99 / 100], latencies.back());
+    }
+
+    return 0;
+}
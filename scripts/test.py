@@ -1,7 +1,11 @@
 import os
+import select
+import socket
 import subprocess
 import sys
-from tempfile import TemporaryFile
+import threading
+import time
+from tempfile import TemporaryDirectory, TemporaryFile
 
 ROOT_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), os.pardir)
 TEST_ROOT_DIR = os.path.join(ROOT_DIR, "test")
@@ -10,22 +14,116 @@ TEST_DIR_PREFIX = "test-"
 INFILE = "in"
 OUTFILE = "out"
 PARAMFILE = "params"
+# Tests with this file keep their input open until the whole of the
+# expected output has arrived, so that output held back until the input
+# ends fails them
+INTERACTIVEFILE = "interactive"
+INTERACTIVE_TIMEOUT = 5
+# Tests with this file serve the tree on a Unix domain socket, and send
+# their input over a connection, closing its end once it is all sent,
+# then read the output until the server closes the connection
+SERVERFILE = "server"
+SERVER_SOCKET = "socket"
+# Tests with this file first run the tree on it, with the same
+# parameters, so that the test proper starts from what that run leaves
+# behind, such as a data directory or a log
+SETUPFILE = "setup"
+# Stands in the parameters for a directory made afresh for each test
+TMPDIR_PARAM = "{tmpdir}"
 SEPARATOR = "-" * 80
 
+def run_interactive(command, infile, expected_length):
+    process = subprocess.Popen(command, stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+    process.stdin.write(infile.read())
+    process.stdin.flush()
+
+    obtained = b""
+    deadline = time.time() + INTERACTIVE_TIMEOUT
+
+    while len(obtained) < expected_length and time.time() < deadline:
+        if select.select([process.stdout], [], [], deadline - time.time())[0]:
+            chunk = os.read(process.stdout.fileno(), 65536)
+            if not chunk:
+                break
+            obtained += chunk
+
+    # Whatever only arrives once the input ends does not count
+    process.stdin.close()
+    process.stdout.read()
+    process.wait()
+
+    return obtained
+
+def run_server(command, infile, socket_path):
+    process = subprocess.Popen(command + ["-s", socket_path])
+    deadline = time.time() + INTERACTIVE_TIMEOUT
+    conn = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+
+    while True:
+        try:
+            conn.connect(socket_path)
+            break
+        except OSError:
+            if time.time() > deadline:
+                raise
+            time.sleep(0.01)
+
+    # The server stops reading while its responses go unread, so they are
+    # read as the input is sent
+    def send():
+        conn.sendall(infile.read())
+        conn.shutdown(socket.SHUT_WR)
+
+    sender = threading.Thread(target=send)
+    sender.start()
+
+    obtained = b""
+    conn.settimeout(INTERACTIVE_TIMEOUT)
+
+    try:
+        while True:
+            chunk = conn.recv(65536)
+            if not chunk:
+                break
+            obtained += chunk
+    except socket.timeout:
+        pass
+
+    sender.join()
+    conn.close()
+    process.terminate()
+    process.wait()
+
+    return obtained
+
 def run_test(test_dir):
     cwd = os.getcwd()
     os.chdir(test_dir)
 
-    with open(INFILE, 'r') as infile, open(OUTFILE, 'r') as outfile, TemporaryFile('r') as dump:
+    with open(INFILE, 'rb') as infile, open(OUTFILE, 'rb') as outfile, TemporaryFile('w+b') as dump, \
+         TemporaryDirectory() as tmpdir:
         try:
             params = open(PARAMFILE, 'r').read().rstrip().split(' ')
         except:
             params = []
 
-        subprocess.call([LSM_TREE_EXECUTABLE] + params, stdin=infile, stdout=dump)
-        dump.seek(0)
+        params = [param.replace(TMPDIR_PARAM, tmpdir) for param in params]
+        expected = outfile.read()
 
-        expected, obtained = outfile.read(), dump.read()
+        if os.path.exists(SETUPFILE):
+            with open(SETUPFILE, 'rb') as setupfile:
+                subprocess.call([LSM_TREE_EXECUTABLE] + params, stdin=setupfile,
+                                stdout=subprocess.DEVNULL)
+
+        if os.path.exists(SERVERFILE):
+            obtained = run_server([LSM_TREE_EXECUTABLE] + params, infile,
+                                  os.path.join(tmpdir, SERVER_SOCKET))
+        elif os.path.exists(INTERACTIVEFILE):
+            obtained = run_interactive([LSM_TREE_EXECUTABLE] + params, infile, len(expected))
+        else:
+            subprocess.call([LSM_TREE_EXECUTABLE] + params, stdin=infile, stdout=dump)
+            dump.seek(0)
+            obtained = dump.read()
 
         if expected == obtained:
             print("* Test {} SUCCEEDED".format(test_dir))
@@ -35,12 +133,12 @@ def run_test(test_dir):
 
             print("Expected:")
             print(SEPARATOR)
-            print(expected)
+            print(expected.decode(errors="replace"))
             print(SEPARATOR)
 
             print("Obtained:")
             print(SEPARATOR)
-            print(obtained)
+            print(obtained.decode(errors="replace"))
             print(SEPARATOR)
 
     os.chdir(cwd)
@@ -0,0 +1,113 @@
+#include "block_cache.h"
+
+using namespace std;
+
+/*
+ * Block cache shard
+ */
+
+bool BlockCacheShard::lookup(uint64_t key) {
+    lock_guard<mutex> guard(lock);
+    unordered_map<uint64_t, list<cache_entry_t>::iterator>::iterator it;
+
+    it = index.find(key);
+
+    if (it == index.end()) {
+        misses++;
+        return false;
+    }
+
+    hits++;
+
+    if (policy == LRU) {
+        entries.splice(entries.begin(), entries, it->second);
+    } else {
+        it->second->referenced = true;
+    }
+
+    return true;
+}
+
+// Check for a block without counting a hit or a miss, or touching its
+// place in the eviction order
+bool BlockCacheShard::contains(uint64_t key) {
+    lock_guard<mutex> guard(lock);
+    return index.count(key) > 0;
+}
+
+void BlockCacheShard::insert(uint64_t key, size_t charge) {
+    lock_guard<mutex> guard(lock);
+    cache_entry_t entry;
+
+    entry.charge = charge;
+
+    // Another query may have cached the block first, and blocks
+    // bigger than the whole shard are never worth caching
+    if (index.count(key) > 0 || entry.charge > capacity) {
+        return;
+    }
+
+    entry.key = key;
+    entry.referenced = false;
+
+    usage += entry.charge;
+    entries.push_front(entry);
+    index[key] = entries.begin();
+
+    while (usage > capacity) {
+        evict();
+    }
+}
+
+/*
+ * Evict one block from the back of the list. Under LRU that is the
+ * least recently used block. Under CLOCK the list acts as the clock
+ * face: a block that was hit since the hand last passed it has its
+ * reference cleared and goes round again instead.
+ */
+
+void BlockCacheShard::evict(void) {
+    while (policy == CLOCK && entries.back().referenced) {
+        entries.back().referenced = false;
+        entries.splice(entries.begin(), entries, prev(entries.end()));
+    }
+
+    usage -= entries.back().charge;
+    index.erase(entries.back().key);
+    entries.pop_back();
+}
+
+/*
+ * Block cache
+ */
+
+BlockCache::BlockCache(size_t capacity, eviction_policy policy) : capacity(capacity) {
+    for (auto& s : shards) {
+        s.capacity = capacity / BLOCK_CACHE_NUM_SHARDS;
+        s.policy = policy;
+    }
+}
+
+bool BlockCache::lookup(uint32_t run_id, uint32_t block) {
+    return shard(block_key(run_id, block)).lookup(block_key(run_id, block));
+}
+
+bool BlockCache::contains(uint32_t run_id, uint32_t block) {
+    return shard(block_key(run_id, block)).contains(block_key(run_id, block));
+}
+
+void BlockCache::insert(uint32_t run_id, uint32_t block, size_t charge) {
+    shard(block_key(run_id, block)).insert(block_key(run_id, block), charge);
+}
+
+long BlockCache::hits(void) {
+    long total = 0;
+    for (auto& s : shards) total += s.hits;
+    return total;
+}
+
+long BlockCache::misses(void) {
+    long total = 0;
+    for (auto& s : shards) total += s.misses;
+    return total;
+}
@@ -0,0 +1,76 @@
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "options.h"
+#include "types.h"
+
+#define BLOCK_CACHE_NUM_SHARDS 16
+
+using namespace std;
+
+/*
+ * In-process cache of run blocks, keyed by run and block index, with a
+ * budget in bytes. Runs are mapped for their whole lifetime, so a block
+ * is always read in place from its run's mapping, and the cache only
+ * keeps track of which blocks it holds and what they are charged,
+ * rather than a copy of their entries.
+ *
+ * The cache is split into shards, each with its own lock and an equal
+ * share of the budget. Within a shard, blocks are evicted either in
+ * least-recently-used order, or by CLOCK, which gives each block that
+ * has been hit since the hand last passed it a second chance.
+ */
+
+struct cache_entry {
+    uint64_t key;
+    size_t charge;
+    bool referenced;
+};
+
+typedef struct cache_entry cache_entry_t;
+
+class BlockCacheShard {
+    mutex lock;
+    list<cache_entry_t> entries;
+    unordered_map<uint64_t, list<cache_entry_t>::iterator> index;
+    size_t usage;
+    void evict(void);
+public:
+    size_t capacity;
+    eviction_policy policy;
+    atomic<long> hits, misses;
+    BlockCacheShard(void) : usage(0), capacity(0), policy(CLOCK), hits(0), misses(0) {}
+    bool lookup(uint64_t);
+    bool contains(uint64_t);
+    void insert(uint64_t, size_t);
+};
+
+class BlockCache {
+    BlockCacheShard shards[BLOCK_CACHE_NUM_SHARDS];
+    BlockCacheShard& shard(uint64_t key) {
+        // Fibonacci hashing, so that consecutive blocks of a run
+        // spread over the shards
+        return shards[((key * 0x9e3779b97f4a7c15) >> 32) % BLOCK_CACHE_NUM_SHARDS];
+    }
+public:
+    size_t capacity;
+    BlockCache(size_t, eviction_policy);
+    static uint64_t block_key(uint32_t run_id, uint32_t block) {
+        return ((uint64_t)run_id << 32) | block;
+    }
+    bool lookup(uint32_t, uint32_t);
+    bool contains(uint32_t, uint32_t);
+    void insert(uint32_t, uint32_t, size_t);
+    long hits(void);
+    long misses(void);
+};
+
+#endif
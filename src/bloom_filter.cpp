@@ -1,59 +1,175 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
 #include "bloom_filter.h"
 
+using namespace std;
+
+BloomFilter::BloomFilter(long num_entries, float bits_per_entry) {
+    long num_bits;
+
+    num_bits = ceil(num_entries * bits_per_entry);
+    num_blocks = max(1L, (num_bits + BLOOM_FILTER_BLOCK_BITS - 1) / BLOOM_FILTER_BLOCK_BITS);
+
+    num_probes = probes_for(bits_per_entry);
+    owned = true;
+
+    table = (uint64_t *)aligned_alloc(BLOOM_FILTER_BLOCK_BITS / 8,
+                                      num_blocks * BLOOM_FILTER_BLOCK_BITS / 8);
+    assert(table != nullptr);
+    memset(table, 0, num_blocks * BLOOM_FILTER_BLOCK_BITS / 8);
+}
+
+BloomFilter::~BloomFilter(void) {
+    if (owned) free(table);
+}
+
 /*
- * Hash functions taken from https://gist.github.com/badboy/6267743
- * and modified for the C++ environment.
+ * Test keys against the given table from now on, rather than this
+ * filter's own. The table must outlive the filter.
  */
 
-uint64_t BloomFilter::hash_1(KEY_t k) const {
-    uint64_t key;
+void BloomFilter::map(const uint64_t *mapped_table, uint64_t mapped_blocks, int mapped_probes) {
+    if (owned) free(table);
+
+    // Mapped tables are only ever tested, never set
+    table = (uint64_t *)mapped_table;
+    num_blocks = mapped_blocks;
+    num_probes = mapped_probes;
+    owned = false;
+}
 
-    key = k;
-    key = ~key + (key<<15);
-    key = key ^ (key>>12);
-    key = key + (key<<2);
-    key = key ^ (key>>4);
-    key = key * 2057;
-    key = key ^ (key>>16);
+int BloomFilter::probes_for(float bits_per_entry) {
+    if (bits_per_entry <= 0) {
+        return 0;
+    }
 
-    return key % table.size();
+    // k = ln(2) * bits per entry gives the lowest false positive rate
+    return min(max((int)round(bits_per_entry * M_LN2), 1), BLOOM_FILTER_MAX_PROBES);
 }
 
-uint64_t BloomFilter::hash_2(KEY_t k) const {
-    uint64_t key;
+/*
+ * Expected false positive rate of a filter, ignoring the small penalty
+ * that comes from keeping all of a key's probes in one block.
+ */
+
+double BloomFilter::false_positive_rate(float bits_per_entry) {
+    int k;
 
-    key = k;
-    key = (key+0x7ed55d16) + (key<<12);
-    key = (key^0xc761c23c) ^ (key>>19);
-    key = (key+0x165667b1) + (key<<5);
-    key = (key+0xd3a2646c) ^ (key<<9);
-    key = (key+0xfd7046c5) + (key<<3);
-    key = (key^0xb55a4f09) ^ (key>>16);
+    if ((k = probes_for(bits_per_entry)) == 0) {
+        return 1;
+    }
 
-    return key % table.size();
+    return pow(1 - exp(-k / bits_per_entry), k);
 }
 
-uint64_t BloomFilter::hash_3(KEY_t k) const {
+/*
+ * 64-bit finalizer from MurmurHash3. The high half of the hash picks
+ * the block, and the low half seeds the probes within it.
+ */
+
+uint64_t BloomFilter::hash(KEY_t k) {
     uint64_t key;
 
-    key = k;
-    key = (key^61) ^ (key>>16);
-    key = key + (key<<3);
-    key = key ^ (key>>4);
-    key = key * 0x27d4eb2d;
-    key = key ^ (key>>15);
+    key = (uint32_t)k;
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccd;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53;
+    key ^= key >> 33;
+
+    return key;
+}
+
+/*
+ * Map the high half of a hash onto [0, num_blocks) with a multiply
+ * and shift, rather than a division.
+ */
 
-    return key % table.size();
+const uint64_t * BloomFilter::block(uint64_t h) const {
+    return table + ((h >> 32) * num_blocks >> 32) * BLOOM_FILTER_BLOCK_WORDS;
 }
 
 void BloomFilter::set(KEY_t key) {
-    table.set(hash_1(key));
-    table.set(hash_2(key));
-    table.set(hash_3(key));
+    uint64_t h, *words;
+    uint32_t probe_hash, bit;
+    int i;
+
+    h = hash(key);
+    words = (uint64_t *)block(h);
+    probe_hash = (uint32_t)h;
+
+    for (i = 0; i < num_probes; i++) {
+        bit = probe_hash >> (32 - BLOOM_FILTER_BLOCK_BITS_LOG);
+        words[bit / 64] |= 1ULL << (bit % 64);
+        probe_hash *= 0x9e3779b9;
+    }
+}
+
+/*
+ * Same as set, but safe to call from several threads at once
+ */
+
+void BloomFilter::set_concurrent(KEY_t key) {
+    uint64_t h, *words;
+    uint32_t probe_hash, bit;
+    int i;
+
+    h = hash(key);
+    words = (uint64_t *)block(h);
+    probe_hash = (uint32_t)h;
+
+    for (i = 0; i < num_probes; i++) {
+        bit = probe_hash >> (32 - BLOOM_FILTER_BLOCK_BITS_LOG);
+        __atomic_fetch_or(&words[bit / 64], 1ULL << (bit % 64), __ATOMIC_RELAXED);
+        probe_hash *= 0x9e3779b9;
+    }
 }
 
-bool BloomFilter::is_set(KEY_t key) const {
-    return (table.test(hash_1(key))
-         && table.test(hash_2(key))
-         && table.test(hash_3(key)));
+bool BloomFilter::test(uint64_t h) const {
+    const uint64_t *words;
+    uint32_t probe_hash, bit;
+    bool found;
+    int i;
+
+    words = block(h);
+    probe_hash = (uint32_t)h;
+    found = true;
+
+    // Test every probe without branching: they all hit the same cache
+    // line, so stopping early saves little and mispredicts often
+    for (i = 0; i < num_probes; i++) {
+        bit = probe_hash >> (32 - BLOOM_FILTER_BLOCK_BITS_LOG);
+        found &= (words[bit / 64] >> (bit % 64)) & 1;
+        probe_hash *= 0x9e3779b9;
+    }
+
+    return found;
+}
+
+/*
+ * Test a batch of keys, setting results[i] for keys[i]. The blocks for
+ * a whole group of keys are prefetched before any is tested, so that
+ * their cache misses overlap rather than follow one another.
+ */
+
+void BloomFilter::is_set(const KEY_t *keys, long num_keys, bool *results) const {
+    uint64_t hashes[BLOOM_FILTER_BATCH_SIZE];
+    long start, count, i;
+
+    for (start = 0; start < num_keys; start += BLOOM_FILTER_BATCH_SIZE) {
+        count = min(num_keys - start, (long)BLOOM_FILTER_BATCH_SIZE);
+
+        for (i = 0; i < count; i++) {
+            hashes[i] = hash(keys[start + i]);
+            __builtin_prefetch(block(hashes[i]));
+        }
+
+        for (i = 0; i < count; i++) {
+            results[start + i] = test(hashes[i]);
+        }
+    }
 }
@@ -1,15 +1,70 @@
-#include <boost/dynamic_bitset.hpp>
-#include <bitset>
+#include <atomic>
+#include <cstdint>
 
 #include "types.h"
 
+// Every probe for a key lands in the same cache line-sized block
+#define BLOOM_FILTER_BLOCK_BITS 512
+#define BLOOM_FILTER_BLOCK_BITS_LOG 9
+#define BLOOM_FILTER_BLOCK_WORDS (BLOOM_FILTER_BLOCK_BITS / 64)
+#define BLOOM_FILTER_MAX_PROBES 16
+
+// Keys tested at once by a batched lookup, whose blocks are fetched
+// from memory together
+#define BLOOM_FILTER_BATCH_SIZE 64
+
+using namespace std;
+
+/*
+ * Blocked Bloom filter: a key hashes to a single 64-byte block, and all
+ * of its probes set or test bits within that block, so a lookup touches
+ * one cache line. The number of probes is the one that minimizes the
+ * false positive rate for the given number of bits per entry. A filter
+ * with no bits per entry has no probes, and lets every key through.
+ *
+ * A filter can also test keys against a table held elsewhere, such as
+ * in the footer of a run file mapped into memory, which it does not
+ * own.
+ */
+
 class BloomFilter {
-   boost::dynamic_bitset<> table;
-   uint64_t hash_1(KEY_t) const;
-   uint64_t hash_2(KEY_t) const;
-   uint64_t hash_3(KEY_t) const;
+    uint64_t *table;
+    uint64_t num_blocks;
+    int num_probes;
+    bool owned;
+    static uint64_t hash(KEY_t);
+    const uint64_t * block(uint64_t) const;
+    bool test(uint64_t) const;
 public:
-    BloomFilter(long length) : table(length) {}
+    BloomFilter(long, float);
+    BloomFilter(const BloomFilter&) = delete;
+    BloomFilter& operator=(const BloomFilter&) = delete;
+    ~BloomFilter(void);
+    static int probes_for(float);
+    static double false_positive_rate(float);
+    void map(const uint64_t *, uint64_t, int);
+    const uint64_t * data(void) const {return table;}
+    uint64_t blocks(void) const {return num_blocks;}
+    int probes(void) const {return num_probes;}
     void set(KEY_t);
-    bool is_set(KEY_t) const;
+    void set_concurrent(KEY_t);
+    bool is_set(KEY_t key) const {return test(hash(key));}
+    void is_set(const KEY_t *, long, bool *) const;
 };
+
+/*
+ * How the filters of the runs in a level have done so far: how many
+ * lookups for keys a run did not hold they turned away, and how many
+ * they let through.
+ */
+
+struct bloom_filter_stats {
+    atomic<long> negatives, false_positives;
+    bloom_filter_stats(void) : negatives(0), false_positives(0) {}
+    double false_positive_rate(void) const {
+        long total = negatives + false_positives;
+        return total > 0 ? (double)false_positives / total : 0;
+    }
+};
+
+typedef struct bloom_filter_stats bloom_filter_stats_t;
@@ -1,17 +1,43 @@
-#include <set>
+#ifndef BUFFER_H
+#define BUFFER_H
+
 #include <vector>
 
 #include "types.h"
 
 using namespace std;
 
+/*
+ * The in-memory component of the tree (the "memtable"). Implementations
+ * must update existing keys in place, so that a buffer never holds more
+ * than one entry per key, and must be able to hand their contents to the
+ * flush path as a contiguous array sorted by key.
+ *
+ * scan copies out up to max_entries entries with keys from start to end
+ * inclusive, in key order, and returns how many it copied. Scans are
+ * taken a chunk at a time so that range queries never copy out more of
+ * the buffer than they use.
+ *
+ * Every write carries a sequence number, and reads see only what was
+ * written at or before the sequence number they are given. A write
+ * replaces the value of a key in place only if no snapshot at or after
+ * pinned may still read that value; otherwise the old value is kept
+ * alongside the new. The tree sets base_seq before handing the buffer
+ * to writers, and every write to it carries a greater sequence number.
+ */
+
 class Buffer {
 public:
-    int max_size;
-    set<entry_t> entries;
-    Buffer(int max_size) : max_size(max_size) {};
-    VAL_t * get(KEY_t) const;
-    vector<entry_t> * range(KEY_t, KEY_t) const;
-    bool put(KEY_t, VAL_t val);
-    void empty(void);
+    long max_size;
+    SEQ_t base_seq;
+    Buffer(long max_size) : max_size(max_size), base_seq(0) {};
+    virtual ~Buffer(void) {};
+    virtual bool get(KEY_t, VAL_t&, SEQ_t) const = 0;
+    virtual long scan(KEY_t, KEY_t, entry_t *, long, SEQ_t) const = 0;
+    virtual bool put(KEY_t, VAL_t, SEQ_t, SEQ_t) = 0;
+    virtual long size(void) const = 0;
+    virtual const entry_t * sorted(void) = 0;
+    virtual void empty(void) = 0;
 };
+
+#endif
@@ -0,0 +1,151 @@
+#include <cstring>
+#include <unistd.h>
+
+#include "io.h"
+
+using namespace std;
+
+static inline bool is_space(int c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/*
+ * Read until at least the given number of bytes are buffered, moving
+ * what is left to the front, and growing the buffer if it is too small.
+ * Returns false if the input ends first.
+ */
+
+bool InputBuffer::fill(size_t length) {
+    ssize_t result;
+
+    if (start > 0) {
+        memmove(data.data(), data.data() + start, end - start);
+        end -= start;
+        start = 0;
+    }
+
+    if (data.size() < length) {
+        data.resize(length);
+    }
+
+    while (end < length) {
+        if ((result = ::read(fd, data.data() + end, data.size() - end)) <= 0) {
+            return false;
+        }
+
+        end += result;
+    }
+
+    return true;
+}
+
+/*
+ * Skip whitespace and take the next character
+ */
+
+int InputBuffer::next(void) {
+    int c;
+
+    while (is_space(c = get())) {}
+
+    return c;
+}
+
+/*
+ * Skip whatever whitespace is already buffered, without reading more,
+ * so that the end of a line does not look like more input to come
+ */
+
+void InputBuffer::skip_buffered_space(void) {
+    while (start < end && is_space(data[start])) start++;
+}
+
+/*
+ * Skip whitespace and parse a decimal integer. Returns false if there is
+ * none, or it has too many digits to be one.
+ */
+
+bool InputBuffer::read_long(long& value) {
+    bool negative;
+    int c, digits;
+
+    while (is_space(c = peek())) start++;
+
+    negative = (c == '-');
+    if (c == '-' || c == '+') start++;
+
+    value = 0;
+    digits = 0;
+
+    while ((c = peek()) >= '0' && c <= '9') {
+        value = value * 10 + (c - '0');
+        digits++;
+        start++;
+    }
+
+    if (negative) value = -value;
+
+    return digits > 0 && digits <= 18;
+}
+
+/*
+ * Skip blanks on the current line, and say whether it ends there
+ */
+
+bool InputBuffer::at_line_end(void) {
+    int c;
+
+    while ((c = peek()) != '\n' && c != EOF && is_space(c)) start++;
+
+    return c == '\n' || c == EOF;
+}
+
+/*
+ * Take the rest of the current line, without its newline
+ */
+
+string InputBuffer::read_line(void) {
+    string line;
+    int c;
+
+    while ((c = get()) != '\n' && c != EOF) line.push_back(c);
+
+    return line;
+}
+
+/*
+ * Take the given number of bytes, contiguous in the buffer until the
+ * next read. Returns nullptr if the input ends first.
+ */
+
+const char * InputBuffer::read_bytes(size_t length) {
+    const char *bytes;
+
+    if (end - start < length && !fill(length)) {
+        return nullptr;
+    }
+
+    bytes = data.data() + start;
+    start += length;
+
+    return bytes;
+}
+
+void OutputBuffer::put_long(long value) {
+    char digits[24];
+    unsigned long magnitude;
+    int i;
+
+    // Negate as unsigned, so that the most negative value works too
+    magnitude = (value < 0) ? -(unsigned long)value : value;
+    i = sizeof(digits);
+
+    do {
+        digits[--i] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude > 0);
+
+    if (value < 0) digits[--i] = '-';
+
+    put(digits + i, sizeof(digits) - i);
+}
@@ -0,0 +1,61 @@
+#ifndef IO_H
+#define IO_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Input is read this many bytes at a time
+#define IO_BUFFER_SIZE (1 << 16)
+
+using namespace std;
+
+/*
+ * Buffered reader over a file descriptor, for parsing commands without
+ * going through iostreams. Text is read a character or an integer at a
+ * time; binary frames are read whole, as contiguous bytes.
+ */
+
+class InputBuffer {
+    int fd;
+    vector<char> data;
+    size_t start, end;
+    bool fill(size_t);
+public:
+    InputBuffer(int fd) : fd(fd), data(IO_BUFFER_SIZE), start(0), end(0) {}
+    // Bytes read but not yet taken, so that taking more may block
+    size_t buffered(void) const {return end - start;}
+    int peek(void) {return (start < end || fill(1)) ? (unsigned char)data[start] : EOF;}
+    int get(void) {return (start < end || fill(1)) ? (unsigned char)data[start++] : EOF;}
+    int next(void);
+    void skip_buffered_space(void);
+    bool read_long(long&);
+    bool at_line_end(void);
+    string read_line(void);
+    const char * read_bytes(size_t);
+};
+
+/*
+ * Buffered writer, either to a stdio stream, which is only flushed when
+ * asked or once its own buffer fills up, or into memory
+ */
+
+class OutputBuffer {
+    FILE *file;
+    string data;
+public:
+    OutputBuffer(FILE *file = nullptr) : file(file) {}
+    void put(char c) {
+        if (file != nullptr) putc_unlocked(c, file);
+        else data.push_back(c);
+    }
+    void put(const void *bytes, size_t length) {
+        if (file != nullptr) fwrite_unlocked(bytes, 1, length, file);
+        else data.append((const char *)bytes, length);
+    }
+    void put_long(long);
+    string& contents(void) {return data;}
+    void flush(void) {if (file != nullptr) fflush(file);}
+};
+
+#endif
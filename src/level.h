@@ -1,12 +1,49 @@
+#include <memory>
 #include <queue>
 
 #include "run.h"
 
+/*
+ * A tiered level holds up to max_runs overlapping runs, ordered from
+ * most to least recent. A leveled level instead holds a single sorted
+ * run of up to max_runs * max_run_size entries, split into files with
+ * disjoint key ranges that are ordered by key.
+ *
+ * Runs written to a level are split into pages of page_size bytes,
+ * each with a fence pointer. Larger pages mean fewer fence pointers to
+ * keep in memory, at the cost of reading more data per lookup.
+ *
+ * Runs written to a level also share its Bloom filter bits per entry,
+ * and report to the level how well their filters did.
+ */
+
 class Level {
 public:
-    int max_runs;
+    size_t max_runs;
     long max_run_size;
-    std::deque<Run> runs;
-    Level(int n, long s) : max_runs(n), max_run_size(s) {}
-    bool remaining(void) const {return max_runs - runs.size();}
+    long page_size;
+    float bf_bits_per_entry;
+    bool leveled;
+    bool compacting;
+    KEY_t compaction_cursor;
+    std::deque<std::shared_ptr<Run>> runs;
+    std::shared_ptr<bloom_filter_stats_t> filter_stats;
+    Level(int n, long s, long p, float b, bool l) : max_runs(n), max_run_size(s), page_size(p),
+                                                    bf_bits_per_entry(b), leveled(l),
+                                                    compacting(false), compaction_cursor(KEY_MIN),
+                                                    filter_stats(std::make_shared<bloom_filter_stats_t>()) {}
+    long max_entries(void) const {return max_runs * max_run_size;}
+    // Entries in each run a lookup probes: a leveled level is one run
+    long probed_run_size(void) const {return leveled ? max_entries() : max_run_size;}
+    long num_entries(void) const {
+        long total = 0;
+        for (const auto& run : runs) total += run->size;
+        return total;
+    }
+    bool full(void) const {
+        return leveled ? num_entries() >= max_entries() : runs.size() >= max_runs;
+    }
+    bool overflowing(void) const {
+        return leveled ? num_entries() > max_entries() : runs.size() > max_runs;
+    }
 };
@@ -0,0 +1,214 @@
+#include <unistd.h>
+#include <vector>
+
+#include "lsm.h"
+#include "lsm_tree.h"
+#include "range_iterator.h"
+#include "version.h"
+
+using namespace std;
+using std::experimental::optional;
+using std::experimental::nullopt;
+
+lsm_options::lsm_options(void) :
+                         buffer_max_entries(DEFAULT_BUFFER_NUM_PAGES * getpagesize() / sizeof(entry_t)),
+                         depth(DEFAULT_TREE_DEPTH),
+                         fanout(DEFAULT_TREE_FANOUT),
+                         num_threads(DEFAULT_THREAD_COUNT),
+                         num_compaction_threads(DEFAULT_COMPACTION_THREAD_COUNT),
+                         pin_threads(DEFAULT_PIN_THREADS),
+                         bf_bits_per_entry(DEFAULT_BF_BITS_PER_ENTRY),
+                         allocation(DEFAULT_FILTER_ALLOCATION),
+                         policy(DEFAULT_MERGE_POLICY),
+                         cache_size(DEFAULT_CACHE_NUM_PAGES * getpagesize()),
+                         eviction(DEFAULT_EVICTION_POLICY),
+                         page_sizes({DEFAULT_PAGE_SIZE}),
+                         run_write_flags(DEFAULT_RUN_WRITE_FLAGS),
+                         durability(DEFAULT_WAL_DURABILITY),
+                         merge_partition_min_entries(DEFAULT_MERGE_PARTITION_MIN_ENTRIES),
+                         get_parallel_min_pages(DEFAULT_GET_PARALLEL_MIN_PAGES)
+{}
+
+Database::Database(LSMTree *tree) : tree(tree) {}
+
+Database::~Database(void) {}
+
+/*
+ * Check the options, since the tree takes them as given, then open the
+ * tree, or else say why it could not be opened
+ */
+
+lsm_status Database::open(const lsm_options_t& options, unique_ptr<Database>& db, string *error) {
+    string problem;
+
+    if (options.buffer_max_entries < 1 || options.depth < 1 || options.fanout < 2
+        || options.num_threads < 1 || options.num_compaction_threads < 1
+        || options.bf_bits_per_entry < 0 || options.cache_size < 0
+        || options.merge_partition_min_entries < 1 || options.get_parallel_min_pages < 1) {
+        problem = "Option out of range.";
+    } else if (options.page_sizes.empty()) {
+        problem = "No page sizes given.";
+    } else if (!options.data_dir.empty() && !options.log_path.empty()) {
+        problem = "A data directory keeps its own log.";
+    }
+
+    for (auto page_size : options.page_sizes) {
+        if (page_size <= 0 || page_size % sizeof(entry_t) != 0) {
+            problem = "Invalid page size " + to_string(page_size) + ": must be a positive "
+                      "multiple of " + to_string(sizeof(entry_t)) + " bytes.";
+        }
+    }
+
+    if (!problem.empty()) {
+        if (error != nullptr) *error = problem;
+        return LSM_INVALID_ARGUMENT;
+    }
+
+    try {
+        db.reset(new Database(new LSMTree(options.buffer_max_entries, options.depth,
+                                          options.fanout, options.num_threads,
+                                          options.num_compaction_threads, options.pin_threads,
+                                          options.bf_bits_per_entry, options.allocation,
+                                          options.policy, options.cache_size, options.eviction,
+                                          options.page_sizes, options.run_write_flags,
+                                          options.data_dir, options.log_path,
+                                          options.durability,
+                                          options.merge_partition_min_entries,
+                                          options.get_parallel_min_pages)));
+    } catch (const TreeError& tree_error) {
+        if (error != nullptr) *error = tree_error.what();
+        return tree_error.status;
+    }
+
+    return LSM_OK;
+}
+
+lsm_status Database::put(KEY_t key, VAL_t val) {
+    entry_t entry;
+
+    entry.key = key;
+    entry.val = val;
+
+    return put(&entry, 1);
+}
+
+/*
+ * The value reserved for deletes cannot be put, so a batch holding it
+ * is rejected whole
+ */
+
+lsm_status Database::put(const entry_t *entries, long num_entries) {
+    long i;
+
+    for (i = 0; i < num_entries; i++) {
+        if (entries[i].val < VAL_MIN || entries[i].val > VAL_MAX) {
+            return LSM_INVALID_ARGUMENT;
+        }
+    }
+
+    try {
+        tree->put(entries, num_entries);
+    } catch (const TreeError& error) {
+        return error.status;
+    }
+
+    return LSM_OK;
+}
+
+lsm_status Database::del(KEY_t key) {
+    return del(&key, 1);
+}
+
+lsm_status Database::del(const KEY_t *keys, long num_keys) {
+    vector<entry_t> entries(num_keys);
+    long i;
+
+    for (i = 0; i < num_keys; i++) {
+        entries[i].key = keys[i];
+        entries[i].val = VAL_TOMBSTONE;
+    }
+
+    try {
+        tree->put(entries.data(), num_keys);
+    } catch (const TreeError& error) {
+        return error.status;
+    }
+
+    return LSM_OK;
+}
+
+optional<VAL_t> Database::get(KEY_t key, const Snapshot *snapshot) {
+    VAL_t val;
+
+    if (tree->get(key, val, snapshot)) {
+        return val;
+    }
+
+    return nullopt;
+}
+
+/*
+ * Look up a batch of keys at once, setting a value for each, empty for
+ * the keys not found
+ */
+
+void Database::get(const KEY_t *keys, long num_keys, optional<VAL_t> *vals,
+                   const Snapshot *snapshot) {
+    vector<VAL_t> found_vals(num_keys);
+    unique_ptr<bool[]> found(new bool[num_keys]);
+    long i;
+
+    tree->multi_get(keys, num_keys, found_vals.data(), found.get(), snapshot);
+
+    for (i = 0; i < num_keys; i++) {
+        vals[i] = found[i] ? optional<VAL_t>(found_vals[i]) : nullopt;
+    }
+}
+
+/*
+ * The iterator starts at the first live entry at or after the start
+ * key, and is exhausted at once if the range is empty
+ */
+
+Database::Iterator Database::range(KEY_t start, KEY_t end, const Snapshot *snapshot) {
+    unique_ptr<RangeIterator> it;
+
+    it = tree->iterator(snapshot);
+    it->set_upper_bound(end);
+    it->seek(start);
+
+    return Iterator(move(it));
+}
+
+Database::Iterator::Iterator(unique_ptr<RangeIterator> it) : it(move(it)) {}
+
+Database::Iterator::Iterator(Iterator&&) = default;
+
+Database::Iterator::~Iterator(void) {}
+
+bool Database::Iterator::valid(void) const {
+    return it->valid();
+}
+
+const entry_t& Database::Iterator::entry(void) const {
+    return it->entry();
+}
+
+void Database::Iterator::next(void) {
+    it->next();
+}
+
+shared_ptr<Snapshot> Database::snapshot(void) {
+    return tree->snapshot();
+}
+
+lsm_status Database::load(string file_path, string *error) {
+    try {
+        tree->load(file_path);
+    } catch (const TreeError& tree_error) {
+        if (error != nullptr) *error = tree_error.what();
+        return tree_error.status;
+    }
+
+    return LSM_OK;
+}
@@ -0,0 +1,68 @@
+#ifndef LSM_H
+#define LSM_H
+
+#include <experimental/optional>
+#include <memory>
+#include <string>
+
+#include "options.h"
+#include "status.h"
+#include "types.h"
+
+// This header is all that code embedding the tree includes, so it keeps
+// the tree's internals out of sight and names nothing into the global
+// namespace from std. The tree builds as C++14, so values that may be
+// missing come as the optional from before C++17, whatever the code
+// embedding it builds as.
+
+class LSMTree;
+class RangeIterator;
+class Snapshot;
+
+/*
+ * The tree as a library, for use in-process: what it does is reported
+ * through status codes, and it never prints or exits.
+ *
+ * Puts and deletes take a batch of entries at a time, which goes into
+ * the tree in order and, with a log, is committed once. Reads may be
+ * made at a snapshot, and a range comes back as an iterator over the
+ * live entries from its start key up to but excluding its end key,
+ * which reads the tree lazily as it advances. Any number of threads may
+ * use a database at once, and its snapshots and iterators must go before
+ * it does.
+ *
+ * Two failures stay fatal to the process: running out of memory, and a
+ * disk failing under a run once it is written, since runs are read
+ * through memory mappings, where that raises SIGBUS.
+ */
+
+class Database {
+    std::unique_ptr<LSMTree> tree;
+    Database(LSMTree *);
+public:
+    class Iterator {
+        std::unique_ptr<RangeIterator> it;
+    public:
+        Iterator(std::unique_ptr<RangeIterator>);
+        Iterator(Iterator&&);
+        ~Iterator(void);
+        bool valid(void) const;
+        const entry_t& entry(void) const;
+        void next(void);
+    };
+    ~Database(void);
+    static lsm_status open(const lsm_options_t&, std::unique_ptr<Database>&,
+                           std::string *error = nullptr);
+    lsm_status put(KEY_t, VAL_t);
+    lsm_status put(const entry_t *, long);
+    lsm_status del(KEY_t);
+    lsm_status del(const KEY_t *, long);
+    std::experimental::optional<VAL_t> get(KEY_t, const Snapshot *snapshot = nullptr);
+    void get(const KEY_t *, long, std::experimental::optional<VAL_t> *,
+             const Snapshot *snapshot = nullptr);
+    Iterator range(KEY_t, KEY_t, const Snapshot *snapshot = nullptr);
+    std::shared_ptr<Snapshot> snapshot(void);
+    lsm_status load(std::string, std::string *error = nullptr);
+};
+
+#endif
@@ -1,10 +1,22 @@
+#include <algorithm>
 #include <cassert>
-#include <fstream>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <dirent.h>
+#include <fcntl.h>
 #include <iostream>
 #include <map>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "lsm_tree.h"
+#include "manifest.h"
 #include "merge.h"
+#include "radix_sort.h"
+#include "skip_list.h"
+#include "status.h"
 #include "sys.h"
 
 using namespace std;
@@ -15,295 +27,1704 @@ ostream& operator<<(ostream& stream, const entry_t& entry) {
     return stream;
 }
 
-istream& operator>>(istream& stream, entry_t& entry) {
-    stream.read((char *)&entry.key, sizeof(KEY_t));
-    stream.read((char *)&entry.val, sizeof(VAL_t));
-    return stream;
+/*
+ * LSM Tree
+ */
+
+LSMTree::LSMTree(int buffer_max_entries, int depth, int fanout,
+                 int num_threads, int num_compaction_threads, bool pin_threads,
+                 float bf_bits_per_entry,
+                 filter_allocation allocation,
+                 merge_policy policy, long cache_size,
+                 eviction_policy eviction, const vector<long>& page_sizes,
+                 int run_write_flags, string data_dir, string log_path,
+                 wal_durability durability, long merge_partition_min_entries,
+                 int get_parallel_min_pages) :
+                 query_scheduler(num_threads, pin_threads),
+                 flush_scheduler(1, pin_threads),
+                 compaction_scheduler(num_compaction_threads, pin_threads),
+                 flush_group(flush_scheduler),
+                 // Runs in a data directory are synced before the
+                 // manifest lists them
+                 run_write_flags(data_dir.empty() ? run_write_flags : run_write_flags | RUN_SYNC),
+                 merge_partition_min_entries(merge_partition_min_entries),
+                 get_parallel_min_pages(get_parallel_min_pages),
+                 wal(nullptr),
+                 data_dir(data_dir),
+                 next_file_number(1),
+                 buffer_log_number(0),
+                 log_number(0),
+                 last_seq(0),
+                 pinned_seq(0),
+                 out_of_space(false),
+                 write_failed(false),
+                 get_counts()
+{
+    long max_run_size, page_size;
+    bool leveled;
+    int i;
+
+    /*
+     * Writers insert into the active buffer while a full buffer is
+     * flushed in the background. Once flushed, and once no version
+     * refers to it any more, that buffer is emptied and kept as the
+     * spare, to become the next active buffer.
+     */
+
+    buffer = share_buffer(new SkipList(buffer_max_entries));
+    spare_buffer = new SkipList(buffer_max_entries);
+
+    block_cache = (cache_size > 0) ? new BlockCache(cache_size, eviction) : nullptr;
+
+    max_run_size = buffer_max_entries;
+
+    /*
+     * Level 0 takes whole buffers as they are flushed, so it is
+     * always tiered. Leveling applies to every level below it, and
+     * lazy leveling only to the last level. Levels past the end of
+     * the page sizes given take the last one.
+     */
+
+    for (i = 0; i < depth; i++) {
+        leveled = (i > 0 && (policy == LEVELING || (policy == LAZY_LEVELING && i == depth - 1)));
+        page_size = page_sizes[min(i, (int)page_sizes.size() - 1)];
+        levels.emplace_back(fanout, max_run_size, page_size, bf_bits_per_entry, leveled);
+        max_run_size *= fanout;
+    }
+
+    if (allocation == MONKEY) allocate_filter_bits(bf_bits_per_entry);
+
+    l0_slowdown_runs = L0_SLOWDOWN_FACTOR * fanout;
+    l0_stop_runs = L0_STOP_FACTOR * fanout;
+
+    install_version();
+
+    /*
+     * Rebuild the tree from its data directory, or from its log,
+     * before logging anything more. Logs are not yet the tree's while
+     * they are replayed, so replayed writes are not logged again.
+     * A tree that fails to open lets go of everything it started.
+     */
+
+    try {
+        if (!data_dir.empty()) {
+            open_data_dir(durability);
+        } else if (!log_path.empty()) {
+            WriteAheadLog::replay(log_path, [this](const entry_t& entry) {put(entry.key, entry.val);});
+            wal = new WriteAheadLog(log_path, durability);
+        }
+    } catch (const TreeError&) {
+        release();
+        throw;
+    }
 }
 
 /*
- * LSM Tree
+ * Monkey: spread a budget of bits_per_entry filter bits for every entry
+ * the tree can hold over its levels, so as to minimize the sum of the
+ * false positive rates of the runs a lookup probes. At the optimum, the
+ * false positive rate of each level is proportional to the size of the
+ * runs it probes, so the small upper levels get the most bits per entry.
+ * Levels whose optimal rate would reach 1 get no filter at all, and the
+ * budget is spread over the rest.
+ */
+
+void LSMTree::allocate_filter_bits(float bits_per_entry) {
+    vector<bool> unfiltered(levels.size(), false);
+    double budget, total_entries, weighted_log_size, log_scale;
+    bool changed;
+    size_t i;
+
+    // Total number of bits, scaled by ln(2)^2 so that a rate of p
+    // costs -ln(p) of it per entry
+    budget = 0;
+    log_scale = 0;
+
+    for (i = 0; i < levels.size(); i++) {
+        budget += levels[i].max_entries() * bits_per_entry * M_LN2 * M_LN2;
+    }
+
+    /*
+     * Each filtered level gets a rate of p = scale * probed run size,
+     * with the scale set to use up the budget
+     */
+
+    do {
+        total_entries = 0;
+        weighted_log_size = 0;
+
+        for (i = 0; i < levels.size(); i++) {
+            if (unfiltered[i]) continue;
+
+            total_entries += levels[i].max_entries();
+            weighted_log_size += levels[i].max_entries() * log(levels[i].probed_run_size());
+        }
+
+        if (total_entries == 0) break;
+
+        log_scale = -(budget + weighted_log_size) / total_entries;
+        changed = false;
+
+        for (i = 0; i < levels.size(); i++) {
+            if (!unfiltered[i] && log_scale + log(levels[i].probed_run_size()) >= 0) {
+                unfiltered[i] = true;
+                changed = true;
+            }
+        }
+    } while (changed);
+
+    for (i = 0; i < levels.size(); i++) {
+        levels[i].bf_bits_per_entry = unfiltered[i] ? 0
+            : -(log_scale + log(levels[i].probed_run_size())) / (M_LN2 * M_LN2);
+    }
+}
+
+/*
+ * Data directories hold run files and logs, numbered in the order they
+ * were created, alongside the manifest
+ */
+
+string LSMTree::data_file(uint64_t number, const char *suffix) const {
+    char name[32];
+
+    snprintf(name, sizeof(name), "%06lu.%s", (unsigned long)number, suffix);
+
+    return data_dir + "/" + name;
+}
+
+string LSMTree::new_run_path(void) {
+    return data_dir.empty() ? "" : data_file(next_file_number++, "run");
+}
+
+/*
+ * List the numbered files in a data directory, with their suffixes
+ */
+
+static vector<pair<uint64_t, string>> list_data_files(const string& path) {
+    vector<pair<uint64_t, string>> files;
+    struct dirent *dir_entry;
+    unsigned long number;
+    char suffix[8];
+    DIR *dir;
+
+    if ((dir = opendir(path.c_str())) == nullptr) {
+        throw TreeError(LSM_IO_ERROR, "Could not read data directory '" + path + "'.");
+    }
+
+    while ((dir_entry = readdir(dir)) != nullptr) {
+        if (sscanf(dir_entry->d_name, "%lu.%7s", &number, suffix) == 2) {
+            files.emplace_back(number, suffix);
+        }
+    }
+
+    closedir(dir);
+    sort(files.begin(), files.end());
+
+    return files;
+}
+
+/*
+ * Open the tree kept in the data directory, creating the directory if
+ * need be. The runs the manifest lists are opened from their footers,
+ * without reading their entries, and the logs of writes that never made
+ * it into a run are replayed, before a new log is started.
+ */
+
+void LSMTree::open_data_dir(wal_durability durability) {
+    unique_lock<shared_timed_mutex> lock(levels_lock, defer_lock);
+    vector<pair<uint64_t, string>> files;
+    manifest_t manifest;
+    shared_ptr<Run> run;
+    bool replayed;
+    size_t i;
+
+    if (mkdir(data_dir.c_str(), 0755) == -1 && errno != EEXIST) {
+        throw TreeError(LSM_IO_ERROR, "Could not create data directory '" + data_dir + "'.");
+    }
+
+    if (read_manifest(data_dir, manifest)) {
+        if (manifest.levels.size() > levels.size()) {
+            throw TreeError(LSM_INVALID_ARGUMENT,
+                            "Data directory '" + data_dir + "' holds more levels than the tree has.");
+        }
+
+        for (i = 0; i < manifest.levels.size(); i++) {
+            if (manifest.levels[i].leveled != levels[i].leveled) {
+                throw TreeError(LSM_INVALID_ARGUMENT, "Data directory '" + data_dir +
+                                "' was written with a different merge policy.");
+            } else if (manifest.levels[i].max_runs != levels[i].max_runs
+                       || manifest.levels[i].max_run_size != levels[i].max_run_size) {
+                throw TreeError(LSM_INVALID_ARGUMENT, "Data directory '" + data_dir +
+                                "' was written with a different fanout or buffer size.");
+            }
+
+            for (const auto& name : manifest.levels[i].runs) {
+                run = make_shared<Run>(data_dir + "/" + name, block_cache);
+                run->filter_stats = levels[i].filter_stats;
+                levels[i].runs.push_back(run);
+            }
+        }
+
+        next_file_number = manifest.next_file_number;
+        log_number = manifest.log_number;
+    }
+
+    remove_obsolete_files(true);
+    install_version();
+
+    files = list_data_files(data_dir);
+    replayed = false;
+
+    // A crash may have left files the manifest does not yet count
+    if (!files.empty() && files.back().first >= next_file_number) {
+        next_file_number = files.back().first + 1;
+    }
+
+    for (const auto& file : files) {
+        if (file.second != "log") continue;
+
+        if (!replayed) {
+            buffer_log_number = file.first;
+            replayed = true;
+        }
+
+        WriteAheadLog::replay(data_file(file.first, "log"), [this](const entry_t& entry) {
+            put(entry.key, entry.val);
+        });
+    }
+
+    if (!replayed) {
+        buffer_log_number = next_file_number;
+    }
+
+    wal = new WriteAheadLog(data_file(next_file_number++, "log"), durability);
+
+    lock.lock();
+
+    save_manifest();
+
+    for (i = 0; i < levels.size(); i++) {
+        schedule_compaction(i);
+    }
+}
+
+/*
+ * Record the runs in every level in the manifest. Called with the
+ * levels lock held exclusively, so that no two manifests are written
+ * at once.
+ */
+
+void LSMTree::save_manifest(void) {
+    manifest_t manifest;
+    manifest_level_t files;
+
+    manifest.next_file_number = next_file_number;
+    manifest.log_number = log_number;
+
+    for (const auto& level : levels) {
+        files.leveled = level.leveled;
+        files.max_runs = level.max_runs;
+        files.max_run_size = level.max_run_size;
+        files.runs.clear();
+
+        for (const auto& run : level.runs) {
+            files.runs.push_back(run->file_path.substr(data_dir.size() + 1));
+        }
+
+        manifest.levels.push_back(files);
+    }
+
+    write_manifest(data_dir, manifest);
+
+    // The runs listed are now part of the tree on disk
+    for (const auto& level : levels) {
+        for (const auto& run : level.runs) run->keep_file = true;
+    }
+}
+
+/*
+ * Remove logs older than the oldest the manifest needs, and, when
+ * opening the tree, run files it does not list, left behind by merges
+ * that a crash cut short
+ */
+
+void LSMTree::remove_obsolete_files(bool opening) {
+    set<string> listed;
+    string path;
+
+    for (const auto& level : levels) {
+        for (const auto& run : level.runs) listed.insert(run->file_path);
+    }
+
+    for (const auto& file : list_data_files(data_dir)) {
+        path = data_file(file.first, file.second.c_str());
+
+        if ((file.second == "log" && file.first < log_number)
+            || (opening && file.second == "run" && listed.count(path) == 0)) {
+            remove(path.c_str());
+        }
+    }
+}
+
+LSMTree::~LSMTree(void) {
+    // A tree kept on disk flushes its buffer, so that it can be
+    // reopened without replaying any log. If that fails, the log
+    // still holds the buffer's writes, to be replayed instead.
+    if (!data_dir.empty() && buffer->size() > 0) {
+        try {
+            freeze_buffer(buffer.get());
+        } catch (const TreeError&) {}
+    }
+
+    release();
+}
+
+/*
+ * Wait for the background work under way, then free the buffers, runs,
+ * cache and log
+ */
+
+void LSMTree::release(void) {
+    unique_lock<shared_timed_mutex> lock(levels_lock, defer_lock);
+
+    flush_group.wait();
+
+    delete wal;
+
+    /*
+     * Let outstanding compactions finish, since they may still
+     * be reading from and writing to runs
+     */
+
+    lock.lock();
+
+    compaction_done.wait(lock, [this] {
+        for (const auto& level : levels) {
+            if (level.compacting) return false;
+        }
+        return true;
+    });
+
+    // Runs still hold a pointer to the cache, and buffers go back to
+    // the spare once the last version refers to them
+    current_version = nullptr;
+    buffer = nullptr;
+    levels.clear();
+    delete spare_buffer;
+    delete block_cache;
+}
+
+void LSMTree::put(KEY_t key, VAL_t val) {
+    entry_t entry;
+
+    entry.key = key;
+    entry.val = val;
+
+    put(&entry, 1);
+}
+
+/*
+ * Write a batch of entries, in order. A batch that fits in the active
+ * buffer goes in whole, with no snapshot taken part way through it,
+ * and with a log waits for its last write alone to be committed.
+ */
+
+void LSMTree::put(const entry_t *entries, long num_entries) {
+    shared_lock<shared_timed_mutex> lock(buffer_lock, defer_lock);
+    Buffer *active;
+    SEQ_t seq;
+    long i;
+
+    check_writable();
+
+    seq = 0;
+    i = 0;
+
+    while (i < num_entries) {
+        /*
+         * Insert the entries into the active buffer. Any number of
+         * writers may do this at once; holding the lock shared only
+         * keeps the buffer from being frozen, or a snapshot from
+         * being taken, under them.
+         */
+
+        lock.lock();
+        active = buffer.get();
+
+        for (; i < num_entries; i++) {
+            seq = (wal != nullptr) ? wal->append(entries[i].key, entries[i].val, last_seq)
+                                   : ++last_seq;
+            if (!active->put(entries[i].key, entries[i].val, seq, pinned_seq)) break;
+        }
+
+        lock.unlock();
+
+        /*
+         * If the buffer is full, swap in a fresh one and flush
+         * the full one in the background, then retry. The retry
+         * takes a new sequence number, and so logs the write again.
+         */
+
+        if (i < num_entries) freeze_buffer(active);
+    }
+
+    if (wal != nullptr && seq != 0) wal->commit(seq);
+}
+
+void LSMTree::freeze_buffer(Buffer *full) {
+    unique_lock<shared_timed_mutex> lock(buffer_lock);
+    shared_lock<shared_timed_mutex> levels_read_lock(levels_lock, defer_lock);
+    worker_task flush = [this] {flush_buffer();};
+    Buffer *spare;
+
+    // Another writer may have already frozen this buffer
+    if (buffer.get() != full) {
+        return;
+    }
+
+    /*
+     * Only one buffer may be flushing at a time, so if the previous
+     * flush is still running, writers stall here until it is done.
+     */
+
+    flush_group.wait();
+
+    throttle_writes();
+
+    // A buffer that failed to flush is still in place
+    check_writable();
+
+    assert(immutable_buffer == nullptr);
+
+    levels_read_lock.lock();
+
+    spare_lock.lock();
+    spare = spare_buffer;
+    spare_buffer = nullptr;
+    spare_lock.unlock();
+
+    if (spare == nullptr) {
+        spare = new SkipList(full->max_size);
+    }
+
+    // No writer is in the buffers, so every write to the fresh one
+    // comes after the last
+    spare->base_seq = last_seq;
+
+    immutable_buffer = buffer;
+    buffer = share_buffer(spare);
+    install_version();
+
+    /*
+     * Log the writes to the new buffer on their own, so that the log
+     * can go once the full buffer is flushed. If the logs cannot be
+     * switched, the full buffer stays where it is, unflushed, and its
+     * writes stay in the log it was in.
+     */
+
+    if (!data_dir.empty() && wal != nullptr) {
+        try {
+            buffer_log_number = next_file_number++;
+            wal->rotate(data_file(buffer_log_number, "log"));
+            sync_directory(data_dir);
+        } catch (const TreeError& error) {
+            fail_writes(error);
+            throw;
+        }
+    }
+
+    levels_read_lock.unlock();
+
+    flush_group.run(flush);
+}
+
+/*
+ * Apply backpressure to writers while compaction is behind. Called
+ * with the buffer lock held exclusively, so every writer waits.
+ */
+
+void LSMTree::throttle_writes(void) {
+    unique_lock<shared_timed_mutex> lock(levels_lock);
+    size_t pending_runs;
+
+    pending_runs = levels.front().runs.size();
+
+    if (pending_runs >= l0_stop_runs) {
+        compaction_done.wait(lock, [this] {
+            return levels.front().runs.size() < l0_stop_runs || write_failed;
+        });
+    } else if (pending_runs >= l0_slowdown_runs) {
+        lock.unlock();
+        this_thread::sleep_for(chrono::milliseconds(WRITE_SLOWDOWN_MS));
+    }
+}
+
+/*
+ * Write the immutable buffer out to a run in level 0. If that fails,
+ * the buffer stays in the tree for reads, and in its log for replay,
+ * and writes to the tree fail from then on.
+ */
+
+void LSMTree::flush_buffer(void) {
+    unique_lock<shared_timed_mutex> lock(levels_lock, defer_lock);
+    shared_ptr<Buffer> full;
+    shared_ptr<Run> run;
+    const entry_t *entries;
+    long num_entries, i;
+
+    full = immutable_buffer;
+
+    try {
+        /*
+         * Write the buffer out to a new run. The run is not yet part
+         * of the tree, so readers carry on searching the immutable
+         * buffer.
+         */
+
+        entries = full->sorted();
+        num_entries = full->size();
+
+        run = make_shared<Run>(levels.front().max_run_size, levels.front().page_size,
+                               levels.front().bf_bits_per_entry, run_write_flags, block_cache,
+                               new_run_path());
+        run->filter_stats = levels.front().filter_stats;
+        run->begin_write();
+
+        for (i = 0; i < num_entries; i++) {
+            run->put(entries[i]);
+        }
+
+        run->seal();
+
+        /*
+         * Swap the immutable buffer for the run in level 0, and merge
+         * level 0 down in the background if it is now full. Until the
+         * manifest lists the run, the older logs stay.
+         */
+
+        lock.lock();
+
+        levels.front().runs.push_front(run);
+        immutable_buffer = nullptr;
+        install_version();
+
+        if (!data_dir.empty()) {
+            log_number = buffer_log_number;
+            save_manifest();
+            remove_obsolete_files(false);
+        }
+    } catch (const TreeError& error) {
+        fail_writes(error);
+        return;
+    }
+
+    check_capacity(0);
+    schedule_compaction(0);
+}
+
+/*
+ * Hand out a buffer whose last reference, from the tree or from any
+ * version, returns it to the tree emptied, as the spare
+ */
+
+shared_ptr<Buffer> LSMTree::share_buffer(Buffer *shared) {
+    return shared_ptr<Buffer>(shared, [this](Buffer *released) {
+        released->empty();
+
+        spare_lock.lock();
+        swap(spare_buffer, released);
+        spare_lock.unlock();
+
+        // There was a spare already
+        delete released;
+    });
+}
+
+/*
+ * Publish the buffers and runs as the current version. Called with the
+ * levels lock held, and either the buffer lock or the levels lock held
+ * exclusively, so that no two versions are installed at once.
+ */
+
+void LSMTree::install_version(void) {
+    shared_ptr<version_t> installed;
+
+    installed = make_shared<version_t>();
+    installed->buffer = buffer;
+    installed->immutable_buffer = immutable_buffer;
+
+    for (const auto& level : levels) {
+        installed->runs.insert(installed->runs.end(), level.runs.begin(), level.runs.end());
+    }
+
+    atomic_store(&current_version, shared_ptr<const version_t>(installed));
+}
+
+/*
+ * The version a read searches, and the sequence number it reads at:
+ * those of its snapshot, or else the current version and everything
+ * written to it
+ */
+
+shared_ptr<const version_t> LSMTree::read_version(const Snapshot *snapshot, SEQ_t& seq) {
+    if (snapshot != nullptr) {
+        seq = snapshot->seq;
+        return snapshot->version;
+    } else {
+        seq = SEQ_MAX;
+        return atomic_load(&current_version);
+    }
+}
+
+/*
+ * Take a snapshot of the tree. Writers are held off while it is taken,
+ * so every write up to its sequence number is complete. Buffers keep the
+ * values the snapshot sees until it is released.
+ */
+
+shared_ptr<Snapshot> LSMTree::snapshot(void) {
+    unique_lock<shared_timed_mutex> lock(buffer_lock);
+    lock_guard<mutex> guard(snapshots_lock);
+    SEQ_t seq;
+
+    seq = last_seq;
+    snapshots.insert(seq);
+    pinned_seq = *snapshots.rbegin();
+
+    return make_shared<Snapshot>(seq, atomic_load(&current_version), [this, seq] {
+        lock_guard<mutex> guard(snapshots_lock);
+
+        snapshots.erase(snapshots.find(seq));
+        pinned_seq = snapshots.empty() ? 0 : *snapshots.rbegin();
+    });
+}
+
+/*
+ * The last level has nowhere to merge down to, so it is an error for
+ * it to take on more than it can hold. What overflowed it stays in the
+ * tree, but every write after fails. Called with the levels lock held.
+ */
+
+void LSMTree::check_capacity(int index) {
+    if (index == (int)levels.size() - 1 && levels[index].overflowing()) {
+        out_of_space = true;
+    }
+}
+
+/*
+ * Once writing to disk has failed, the runs and manifest on disk may no
+ * longer match the tree, so the tree takes no more writes, while its
+ * reads carry on. Only the first failure is kept, as the cause.
+ */
+
+void LSMTree::fail_writes(const TreeError& error) {
+    lock_guard<mutex> guard(write_error_lock);
+
+    if (!write_failed) {
+        write_error = error.what();
+        write_failed = true;
+    }
+}
+
+void LSMTree::check_writable(void) {
+    if (out_of_space) {
+        throw TreeError(LSM_NO_SPACE, "No more space in tree.");
+    } else if (write_failed) {
+        lock_guard<mutex> guard(write_error_lock);
+        throw TreeError(LSM_IO_ERROR, write_error);
+    }
+}
+
+/*
+ * Queue a background merge of a level into the next one if the level
+ * is full and no merge of it is already under way. Called with the
+ * levels lock held exclusively.
+ */
+
+void LSMTree::schedule_compaction(int index) {
+    worker_task compaction = [this, index] {compact(index);};
+
+    if (index < 0 || index >= (int)levels.size() - 1 || write_failed) {
+        return;
+    } else if (levels[index].compacting || !levels[index].full()) {
+        return;
+    }
+
+    /*
+     * Tiered levels only ever gain runs at the front and lose them
+     * from the back, so they can be merged into and out of at once.
+     * The files of a leveled level, however, may be rewritten by a
+     * merge from above, so a leveled level can take part in only one
+     * merge at a time.
+     */
+
+    if (levels[index].leveled && index > 0 && levels[index - 1].compacting) {
+        return;
+    } else if (levels[index + 1].leveled && levels[index + 1].compacting) {
+        return;
+    }
+
+    levels[index].compacting = true;
+    compaction_scheduler.submit(compaction);
+}
+
+/*
+ * Pick keys that split the inputs of a merge into the given number of
+ * key ranges, each holding about the same number of entries. Every
+ * fence pointer of an input stands for the page of entries it starts.
+ */
+
+static vector<KEY_t> partition_keys(const vector<shared_ptr<Run>>& inputs,
+                                    long total_size, int num_partitions) {
+    vector<pair<KEY_t, long>> pages;
+    vector<KEY_t> keys;
+    long entries_per_page, covered, p;
+    int partition;
+
+    for (const auto& run : inputs) {
+        entries_per_page = run->page_size / sizeof(entry_t);
+
+        for (p = 0; p < (long)run->fences().size(); p++) {
+            pages.emplace_back(run->fences()[p], min(entries_per_page, run->size - p * entries_per_page));
+        }
+    }
+
+    sort(pages.begin(), pages.end());
+
+    covered = 0;
+    partition = 1;
+
+    for (const auto& page : pages) {
+        if (partition == num_partitions) break;
+
+        if (covered >= total_size * partition / num_partitions) {
+            if (keys.empty() || page.first > keys.back()) keys.push_back(page.first);
+            partition++;
+        }
+
+        covered += page.second;
+    }
+
+    return keys;
+}
+
+/*
+ * Run a merge of a level down, scheduled in the background. A merge
+ * that fails to write to disk leaves the tree as it was, or, if only
+ * its manifest could not be saved, as it would have left it; either
+ * way, writes to the tree fail from then on.
+ */
+
+void LSMTree::compact(int index) {
+    try {
+        merge_down(index);
+    } catch (const TreeError& error) {
+        fail_writes(error);
+
+        levels_lock.lock();
+        levels[index].compacting = false;
+        levels_lock.unlock();
+
+        compaction_done.notify_all();
+    }
+}
+
+/*
+ * Merge a level down into the next one. The merge itself runs without
+ * holding the levels lock, so queries and flushes carry on around it.
+ *
+ * From a tiered level, every run currently in the level is merged;
+ * runs that arrive meanwhile are newer than the inputs and are left in
+ * place. From a leveled level, only enough files are merged to bring
+ * it back within capacity, taking the files in turn by key.
+ *
+ * Into a tiered level, the merge produces one new run at the front of
+ * the level. Into a leveled level, the inputs are merged with only the
+ * files they overlap, and those files are replaced with new ones.
+ *
+ * Large merges are split into key ranges that are merged in parallel on
+ * the compaction scheduler. Into a leveled level, each range is written
+ * to files of its own. Into a tiered level, each range is merged
+ * straight into its own region of the single output run, sized for its
+ * inputs; the regions are then packed together, closing the gaps left
+ * by the entries the merge dropped.
  */
 
-LSMTree::LSMTree(int buffer_max_entries, int depth, int fanout,
-                 int num_threads, float bf_bits_per_entry) :
-                 bf_bits_per_entry(bf_bits_per_entry),
-                 buffer(buffer_max_entries),
-                 worker_pool(num_threads)
-{
-    long max_run_size;
+void LSMTree::merge_down(int index) {
+    unique_lock<shared_timed_mutex> lock(levels_lock, defer_lock);
+    Level *current, *next;
+    vector<shared_ptr<Run>> inputs, overlapping, outputs;
+    vector<vector<shared_ptr<Run>>> partition_outputs;
+    vector<vector<long>> bounds;
+    vector<long> offsets, region_sizes;
+    vector<KEY_t> split_keys;
+    vector<worker_task> tasks;
+    shared_ptr<Run> output;
+    KEY_t min_key, max_key;
+    long total_size, file_size, excess;
+    bool remove_tombstones;
+    size_t first, r;
+    int num_partitions, j;
+
+    current = &levels[index];
+    next = &levels[index + 1];
+    file_size = levels.front().max_run_size;
+
+    levels_lock.lock_shared();
+
+    if (current->leveled) {
+        /*
+         * Take consecutive files from where the last merge left off
+         * until the level is back within its capacity, so that a
+         * level that fell behind catches up in fewer merges
+         */
+
+        excess = current->num_entries() - current->max_entries();
+        first = 0;
+
+        while (first < current->runs.size()
+               && current->runs[first]->min_key <= current->compaction_cursor) {
+            first++;
+        }
 
-    max_run_size = buffer_max_entries;
+        if (first == current->runs.size()) first = 0;
 
-    while ((depth--) > 0) {
-        levels.emplace_back(fanout, max_run_size);
-        max_run_size *= fanout;
+        do {
+            inputs.push_back(current->runs[first]);
+            excess -= current->runs[first]->size;
+            first++;
+        } while (excess >= 0 && first < current->runs.size() && inputs.size() < current->max_runs);
+    } else {
+        inputs.assign(current->runs.begin(), current->runs.end());
     }
-}
 
-void LSMTree::merge_down(vector<Level>::iterator current) {
-    vector<Level>::iterator next;
-    MergeContext merge_ctx;
-    entry_t entry;
+    min_key = KEY_MAX;
+    max_key = KEY_MIN;
 
-    assert(current >= levels.begin());
+    for (const auto& run : inputs) {
+        min_key = min(min_key, run->min_key);
+        max_key = max(max_key, run->max_key);
+    }
 
-    if (current->remaining() > 0) {
-        return;
-    } else if (current >= levels.end() - 1) {
-        die("No more space in tree.");
-    } else {
-        next = current + 1;
+    if (next->leveled) {
+        for (const auto& run : next->runs) {
+            if (run->overlaps(min_key, max_key)) overlapping.push_back(run);
+        }
     }
 
+    // Deleted keys can only be dropped if there are no older
+    // entries left below for them to shadow
+    remove_tombstones = (index + 1 == (int)levels.size() - 1
+                         && (next->leveled || next->runs.empty()));
+
+    levels_lock.unlock_shared();
+
     /*
-     * If the next level does not have space for the current level,
-     * recursively merge the next level downwards to create some
+     * Merge the input runs, most recent first, then any overlapping
+     * files in the next level. bounds[j][r] is the position in input r
+     * at which key range j starts.
      */
 
-    if (next->remaining() == 0) {
-        merge_down(next);
-        assert(next->remaining() > 0);
+    inputs.insert(inputs.end(), overlapping.begin(), overlapping.end());
+    total_size = 0;
+
+    for (const auto& run : inputs) {
+        total_size += run->size;
     }
 
-    /*
-     * Merge all runs in the current level into the first
-     * run in the next level
-     */
+    num_partitions = max(1L, min((long)compaction_scheduler.size(), total_size / merge_partition_min_entries));
+    split_keys = partition_keys(inputs, total_size, num_partitions);
+    num_partitions = split_keys.size() + 1;
+
+    bounds.assign(num_partitions + 1, vector<long>(inputs.size()));
+
+    for (r = 0; r < inputs.size(); r++) {
+        bounds[0][r] = 0;
+        bounds[num_partitions][r] = inputs[r]->size;
 
-    for (auto& run : current->runs) {
-        merge_ctx.add(run.map_read(), run.size);
+        for (j = 1; j < num_partitions; j++) {
+            bounds[j][r] = inputs[r]->rank(split_keys[j - 1]);
+        }
     }
 
-    next->runs.emplace_front(next->max_run_size, bf_bits_per_entry);
-    next->runs.front().map_write();
+    auto run_tasks = [&](vector<worker_task>& tasks) {
+        TaskGroup group(compaction_scheduler);
+
+        // Keep the first range for this thread rather than waiting idle
+        for (auto it = tasks.begin() + 1; it < tasks.end(); it++) group.run(*it);
+
+        tasks.front()();
+        group.wait();
+    };
+
+    auto merge_partition = [&](int j, auto write) {
+        MergeContext merge_ctx;
+        entry_t batch[MERGE_BATCH_SIZE];
+        long batch_size, i;
+        size_t r;
+
+        for (r = 0; r < inputs.size(); r++) {
+            merge_ctx.add(inputs[r]->entries() + bounds[j][r], bounds[j + 1][r] - bounds[j][r]);
+        }
+
+        while ((batch_size = merge_ctx.next(batch, MERGE_BATCH_SIZE)) > 0) {
+            for (i = 0; i < batch_size; i++) {
+                if (!remove_tombstones || batch[i].val != VAL_TOMBSTONE) write(batch[i]);
+            }
+        }
+    };
+
+    if (next->leveled) {
+        partition_outputs.resize(num_partitions);
 
-    while (!merge_ctx.done()) {
-        entry = merge_ctx.next();
+        for (j = 0; j < num_partitions; j++) {
+            tasks.push_back([&, j] {
+                vector<shared_ptr<Run>>& files = partition_outputs[j];
 
-        // Remove deleted keys from the final level
-        if (!(next == levels.end() - 1 && entry.val == VAL_TOMBSTONE)) {
-            next->runs.front().put(entry);
+                merge_partition(j, [&](const entry_t& entry) {
+                    if (files.empty() || files.back()->size == file_size) {
+                        if (!files.empty()) files.back()->seal();
+
+                        files.push_back(make_shared<Run>(file_size, next->page_size,
+                                                         next->bf_bits_per_entry, run_write_flags,
+                                                         block_cache, new_run_path()));
+                        files.back()->filter_stats = next->filter_stats;
+                        files.back()->begin_write();
+                    }
+
+                    files.back()->put(entry);
+                });
+
+                if (!files.empty()) files.back()->seal();
+            });
+        }
+    } else {
+        // A tiered level that fell behind may hold more runs than
+        // usual, so size the output for whatever it actually holds
+        output = make_shared<Run>(max(next->max_run_size, total_size), next->page_size,
+                                  next->bf_bits_per_entry, run_write_flags, block_cache,
+                                  new_run_path());
+        output->filter_stats = next->filter_stats;
+        output->begin_write();
+
+        if (num_partitions == 1) {
+            tasks.push_back([&] {
+                merge_partition(0, [&](const entry_t& entry) {output->put(entry);});
+            });
+        } else {
+            /*
+             * A key range merges to at most as many entries as its
+             * inputs hold there, so each can be written straight to a
+             * region of the run that size
+             */
+
+            offsets.assign(num_partitions, 0);
+            region_sizes.assign(num_partitions, 0);
+
+            for (j = 1; j < num_partitions; j++) {
+                offsets[j] = offsets[j - 1];
+
+                for (r = 0; r < inputs.size(); r++) {
+                    offsets[j] += bounds[j][r] - bounds[j - 1][r];
+                }
+            }
+
+            for (j = 0; j < num_partitions; j++) {
+                tasks.push_back([&, j] {
+                    unique_ptr<RunWriter> writer = output->writer_at(offsets[j]);
+
+                    merge_partition(j, [&](const entry_t& entry) {
+                        output->put(*writer, entry);
+                        region_sizes[j]++;
+                    });
+                    writer->flush();
+                });
+            }
         }
     }
 
-    next->runs.front().unmap();
+    run_tasks(tasks);
+
+    if (!next->leveled && num_partitions > 1) {
+        output->pack(offsets, region_sizes);
+    }
 
-    for (auto& run : current->runs) {
-        run.unmap();
+    if (next->leveled) {
+        for (const auto& files : partition_outputs) {
+            outputs.insert(outputs.end(), files.begin(), files.end());
+        }
+    } else if (output->size > 0) {
+        output->seal();
+    } else {
+        output = nullptr;
     }
 
+    inputs.resize(inputs.size() - overlapping.size());
+
     /*
-     * Clear the current level to delete the old (now
-     * redundant) entry files.
+     * Install the output and drop the inputs
      */
 
-    current->runs.clear();
+    lock.lock();
+
+    if (current->leveled) {
+        for (const auto& run : inputs) {
+            current->runs.erase(find(current->runs.begin(), current->runs.end(), run));
+        }
+
+        current->compaction_cursor = inputs.back()->max_key;
+    } else {
+        // The inputs are always the oldest runs in the level
+        current->runs.erase(current->runs.end() - inputs.size(), current->runs.end());
+    }
+
+    if (next->leveled) {
+        for (const auto& run : overlapping) {
+            next->runs.erase(find(next->runs.begin(), next->runs.end(), run));
+        }
+
+        next->runs.insert(next->runs.end(), outputs.begin(), outputs.end());
+
+        sort(next->runs.begin(), next->runs.end(),
+             [](const shared_ptr<Run>& a, const shared_ptr<Run>& b) {
+                 return a->min_key < b->min_key;
+             });
+    } else if (output != nullptr) {
+        next->runs.push_front(output);
+    }
+
+    install_version();
+
+    if (!data_dir.empty()) {
+        save_manifest();
+
+        // The files merged away go once nothing reads them any more
+        for (const auto& run : inputs) run->keep_file = false;
+        for (const auto& run : overlapping) run->keep_file = false;
+    }
+
+    current->compacting = false;
+
+    check_capacity(index + 1);
+
+    // Give deeper levels the first chance to make room
+    schedule_compaction(index + 1);
+    schedule_compaction(index);
+    schedule_compaction(index - 1);
+
+    lock.unlock();
+
+    compaction_done.notify_all();
 }
 
-void LSMTree::put(KEY_t key, VAL_t val) {
-    /*
-     * Try inserting the key into the buffer
-     */
+/*
+ * Compaction debt is the number of entries sitting in levels that are
+ * due to be merged down, either waiting for a merge or undergoing one.
+ */
 
-    if (buffer.put(key, val)) {
-        return;
+long LSMTree::compaction_debt(void) {
+    shared_lock<shared_timed_mutex> read_lock(levels_lock);
+    long debt;
+    size_t i;
+
+    debt = 0;
+
+    for (i = 0; i < levels.size() - 1; i++) {
+        if (levels[i].compacting || levels[i].full()) {
+            debt += levels[i].num_entries();
+        }
+    }
+
+    return debt;
+}
+
+void LSMTree::stats(void) {
+    long debt;
+    size_t i;
+
+    debt = compaction_debt();
+
+    levels_lock.lock_shared();
+
+    for (i = 0; i < levels.size(); i++) {
+        cout << "Level " << i << ": ";
+
+        if (levels[i].leveled) {
+            cout << levels[i].runs.size() << " files, "
+                 << levels[i].num_entries() << "/" << levels[i].max_entries() << " entries";
+        } else {
+            cout << levels[i].runs.size() << "/" << levels[i].max_runs << " runs, "
+                 << levels[i].num_entries() << " entries";
+        }
+
+        cout << ", " << levels[i].page_size << "-byte pages, "
+             << levels[i].bf_bits_per_entry << " filter bits/entry, false positive rate "
+             << BloomFilter::false_positive_rate(levels[i].bf_bits_per_entry) << " expected, "
+             << levels[i].filter_stats->false_positive_rate() << " measured";
+
+        if (levels[i].compacting) cout << " (compacting)";
+        cout << endl;
+    }
+
+    levels_lock.unlock_shared();
+
+    cout << "Compaction debt: " << debt << " entries" << endl;
+
+    cout << "Gets: " << get_counts.paths[BUFFER_GET] << " from buffers, "
+         << get_counts.paths[INLINE_GET] << " inline, "
+         << get_counts.paths[PARALLEL_GET] << " in parallel, "
+         << get_counts.pages_searched << " run pages searched" << endl;
+
+    if (block_cache != nullptr) {
+        cout << "Block cache: " << block_cache->hits() << " hits, "
+             << block_cache->misses() << " misses" << endl;
     }
+}
+
+/*
+ * Look up a key in the buffers, then in the runs, most recent first.
+ * Runs are first narrowed down to those whose filters let the key
+ * through. Usually only a few are left, or the pages they would hold
+ * the key in are cached, and these are searched right here in order
+ * until one holds the key. Only when enough of their pages have to be
+ * read from the runs are they searched on the query threads at once.
+ *
+ * Returns whether the key was found, setting its value if so. Deleted
+ * keys are not found.
+ */
+
+bool LSMTree::get(KEY_t key, VAL_t& found_val, const Snapshot *snapshot) {
+    shared_ptr<const version_t> version;
+    SEQ_t seq;
+    Buffer *buffers[2];
+    vector<pair<Run *, long>> candidates;
+    unique_ptr<VAL_t[]> vals;
+    atomic<long> next_candidate, first_hit, pages_searched;
+    TaskGroup group(query_scheduler);
+    VAL_t val;
+    long page_index, num_uncached, i;
+    bool hit;
+
+    version = read_version(snapshot, seq);
 
     /*
-     * If the buffer is full, flush level 0 if necessary
-     * to create space
+     * Search buffers, most recent first
      */
 
-    merge_down(levels.begin());
+    buffers[0] = version->buffer.get();
+    buffers[1] = version->immutable_buffer.get();
+
+    for (auto b : buffers) {
+        if (b == nullptr || !b->get(key, val, seq)) {
+            continue;
+        }
+
+        record_get(BUFFER_GET, 0);
+
+        found_val = val;
+        return val != VAL_TOMBSTONE;
+    }
 
     /*
-     * Flush the buffer to level 0
+     * Find the runs that may hold the key
      */
 
-    levels.front().runs.emplace_front(levels.front().max_run_size, bf_bits_per_entry);
-    levels.front().runs.front().map_write();
+    num_uncached = 0;
 
-    for (const auto& entry : buffer.entries) {
-        levels.front().runs.front().put(entry);
-    }
+    for (const auto& run : version->runs) {
+        if (!run->may_contain(key)) continue;
 
-    levels.front().runs.front().unmap();
+        page_index = run->page_of(key);
+        candidates.push_back({run.get(), page_index});
+
+        if (!run->cached(page_index)) num_uncached++;
+    }
 
     /*
-     * Empty the buffer and insert the key/value pair
+     * Search them
      */
 
-    buffer.empty();
-    assert(buffer.put(key, val));
-}
+    hit = false;
 
-Run * LSMTree::get_run(int index) {
-    for (const auto& level : levels) {
-        if (index < level.runs.size()) {
-            return (Run *) &level.runs[index];
-        } else {
-            index -= level.runs.size();
+    if (num_uncached < get_parallel_min_pages) {
+        for (i = 0; i < (long)candidates.size() && !hit; i++) {
+            hit = candidates[i].first->get_from_page(candidates[i].second, key, val);
         }
+
+        record_get(INLINE_GET, i);
+    } else {
+        /*
+         * Each query thread, and this one, takes the next run to
+         * search in order until a more recent run turns up the key.
+         * Each search records its result in its own slot.
+         */
+
+        vals.reset(new VAL_t[candidates.size()]);
+        next_candidate = 0;
+        first_hit = candidates.size();
+        pages_searched = 0;
+
+        worker_task search = [&] {
+            long current, j;
+
+            while ((j = next_candidate++) < first_hit) {
+                pages_searched++;
+
+                if (!candidates[j].first->get_from_page(candidates[j].second, key, vals[j])) {
+                    continue;
+                }
+
+                current = first_hit;
+                while (j < current && !first_hit.compare_exchange_weak(current, j)) {}
+            }
+        };
+
+        for (i = 0; i < query_scheduler.size(); i++) group.run(search);
+
+        group.wait();
+
+        if ((hit = first_hit < (long)candidates.size())) val = vals[first_hit];
+
+        record_get(PARALLEL_GET, pages_searched);
     }
 
-    return nullptr;
-};
+    found_val = val;
+    return hit && val != VAL_TOMBSTONE;
+}
+
+void LSMTree::record_get(get_path path, long pages_searched) {
+    get_counts.paths[path].fetch_add(1, memory_order_relaxed);
+    get_counts.pages_searched.fetch_add(pages_searched, memory_order_relaxed);
+}
+
+/*
+ * Look up a batch of keys at once, setting the value and whether it was
+ * found for each, in the order given, as get would, and returning how
+ * many were found. The keys are sorted, and the ones still
+ * unresolved are handed to each run in turn, most recent first, for the
+ * run to filter and read together. The search ends as soon as every key
+ * is resolved.
+ */
 
-void LSMTree::get(KEY_t key) {
-    VAL_t *buffer_val;
-    VAL_t latest_val;
-    int latest_run;
-    SpinLock lock;
-    atomic<int> counter;
+long LSMTree::multi_get(const KEY_t *keys, long num_keys, VAL_t *key_vals, bool *key_found,
+                        const Snapshot *snapshot) {
+    shared_ptr<const version_t> version;
+    SEQ_t seq;
+    vector<KEY_t> sorted_keys, pending_keys;
+    vector<long> pending;
+    Buffer *buffers[2];
+    unique_ptr<VAL_t[]> vals, pending_vals;
+    unique_ptr<bool[]> found, pending_found;
+    long num_pending, num_found, i, k;
+
+    sorted_keys.assign(keys, keys + num_keys);
+    sort(sorted_keys.begin(), sorted_keys.end());
+    sorted_keys.erase(unique(sorted_keys.begin(), sorted_keys.end()), sorted_keys.end());
+
+    vals.reset(new VAL_t[sorted_keys.size()]);
+    found.reset(new bool[sorted_keys.size()]());
+
+    version = read_version(snapshot, seq);
 
     /*
-     * Search buffer
+     * Search buffers, most recent first
      */
 
-    buffer_val = buffer.get(key);
+    buffers[0] = version->buffer.get();
+    buffers[1] = version->immutable_buffer.get();
 
-    if (buffer_val != nullptr) {
-        if (*buffer_val != VAL_TOMBSTONE) cout << *buffer_val;
-        cout << endl;
-        delete buffer_val;
-        return;
+    for (i = 0; i < (long)sorted_keys.size(); i++) {
+        for (auto b : buffers) {
+            if (b != nullptr && b->get(sorted_keys[i], vals[i], seq)) {
+                found[i] = true;
+                break;
+            }
+        }
+
+        if (!found[i]) {
+            pending.push_back(i);
+            pending_keys.push_back(sorted_keys[i]);
+        }
     }
 
     /*
-     * Search runs
+     * Search runs, narrowing down the pending keys after each
      */
 
-    counter = 0;
-    latest_run = -1;
+    pending_vals.reset(new VAL_t[pending.size()]);
+    pending_found.reset(new bool[pending.size()]);
 
-    worker_task search = [&] {
-        int current_run;
-        Run *run;
-        VAL_t *current_val;
+    for (const auto& run : version->runs) {
+        if (pending.empty()) break;
 
-        current_run = counter++;
+        num_pending = pending.size();
+        fill(pending_found.get(), pending_found.get() + num_pending, false);
 
-        if (latest_run >= 0 || (run = get_run(current_run)) == nullptr) {
-            // Stop search if we discovered a key in another run, or
-            // if there are no more runs to search
-            return;
-        } else if ((current_val = run->get(key)) == nullptr) {
-            // Couldn't find the key in the current run, so we need
-            // to keep searching.
-            search();
-        } else {
-            // Update val if the run is more recent than the
-            // last, then stop searching since there's no need
-            // to search later runs.
-            lock.lock();
-
-            if (latest_run < 0 || current_run < latest_run) {
-                latest_run = current_run;
-                latest_val = *current_val;
+        if (run->multi_get(pending_keys.data(), num_pending, pending_vals.get(),
+                           pending_found.get()) == 0) {
+            continue;
+        }
+
+        k = 0;
+
+        for (i = 0; i < num_pending; i++) {
+            if (pending_found[i]) {
+                vals[pending[i]] = pending_vals[i];
+                found[pending[i]] = true;
+            } else {
+                pending[k] = pending[i];
+                pending_keys[k] = pending_keys[i];
+                k++;
             }
+        }
+
+        pending.resize(k);
+        pending_keys.resize(k);
+    }
+
+    num_found = 0;
+
+    for (k = 0; k < num_keys; k++) {
+        i = lower_bound(sorted_keys.begin(), sorted_keys.end(), keys[k]) - sorted_keys.begin();
+        key_vals[k] = vals[i];
+        key_found[k] = found[i] && vals[i] != VAL_TOMBSTONE;
+        num_found += key_found[k];
+    }
+
+    return num_found;
+}
+
+unique_ptr<RangeIterator> LSMTree::iterator(const Snapshot *snapshot) {
+    shared_ptr<const version_t> version;
+    SEQ_t seq;
+
+    version = read_version(snapshot, seq);
+
+    return unique_ptr<RangeIterator>(new RangeIterator(version, seq));
+}
+
+void LSMTree::del(KEY_t key) {
+    put(key, VAL_TOMBSTONE);
+}
+
+/*
+ * Whether a run of the given number of entries, all of them more recent
+ * than anything in the tree, could be added to a level as it is. No
+ * level above may hold any of its keys, or their older entries would
+ * shadow the new ones. A leveled level must hold none of them either,
+ * and must have room for the entries; and no merge may be running into
+ * it, since that might write files spanning the new ones. A tiered
+ * level only takes runs of the size that form there, and must have
+ * room for another. Level 0 takes anything. Called with the levels
+ * lock held.
+ */
 
-            lock.unlock();
-            delete current_val;
+bool LSMTree::can_ingest(int index, KEY_t min_key, KEY_t max_key, long num_entries) const {
+    const Level& level = levels[index];
+    int i;
+
+    if (index == 0) {
+        return true;
+    }
+
+    for (i = 0; i < index; i++) {
+        for (const auto& run : levels[i].runs) {
+            if (run->overlaps(min_key, max_key)) return false;
         }
-    };
+    }
+
+    if (level.leveled) {
+        if (levels[index - 1].compacting) return false;
+
+        for (const auto& run : level.runs) {
+            if (run->overlaps(min_key, max_key)) return false;
+        }
+
+        return level.num_entries() + num_entries <= level.max_entries();
+    } else {
+        return num_entries > levels[index - 1].max_run_size
+               && num_entries <= level.max_run_size
+               && level.runs.size() < level.max_runs;
+    }
+}
+
+/*
+ * A sorted chunk of the entries of a load, held in memory, or in a
+ * temporary run once the load holds too many entries to keep in memory
+ */
+
+struct load_chunk {
+    vector<entry_t> entries;
+    shared_ptr<Run> run;
+    const entry_t * data(void) const {return run != nullptr ? run->entries() : entries.data();}
+    long size(void) const {return run != nullptr ? run->size : entries.size();}
+};
+
+typedef struct load_chunk load_chunk_t;
+
+/*
+ * Sort a chunk of loaded entries, keeping only the last entry for each
+ * key, and spill it to a temporary run if asked to
+ */
+
+static void sort_chunk(const entry_t *input, long num_entries, bool spill, long page_size,
+                       Scheduler& scheduler, load_chunk_t& chunk) {
+    vector<entry_t> scratch(num_entries);
+    long i;
+
+    chunk.entries.assign(input, input + num_entries);
+    num_entries = radix_sort(chunk.entries.data(), num_entries, scratch.data(), &scheduler);
+    chunk.entries.resize(num_entries);
+
+    if (!spill) return;
+
+    chunk.run = make_shared<Run>(num_entries, page_size, 0, 0, nullptr);
+    chunk.run->begin_write();
+
+    for (i = 0; i < num_entries; i++) {
+        chunk.run->put(chunk.entries[i]);
+    }
+
+    chunk.run->seal();
 
-    worker_pool.launch(search);
-    worker_pool.wait_all();
+    vector<entry_t>().swap(chunk.entries);
+}
+
+/*
+ * Whether runs written for one level suit another as they are
+ */
 
-    if (latest_run >= 0 && latest_val != VAL_TOMBSTONE) cout << latest_val;
-    cout << endl;
+static bool same_shape(const Level& a, const Level& b) {
+    return a.page_size == b.page_size && a.bf_bits_per_entry == b.bf_bits_per_entry
+           && a.leveled == b.leveled;
 }
 
-void LSMTree::range(KEY_t start, KEY_t end) {
-    vector<entry_t> *buffer_range;
-    map<int, vector<entry_t> *> ranges;
-    SpinLock lock;
-    atomic<int> counter;
+/*
+ * Load a file of entries, as if each were put in turn, so that later
+ * entries for a key override earlier ones. Rather than going through
+ * the buffer, the entries are sorted and written straight out to runs,
+ * which are added to the deepest level that can take them.
+ *
+ * Input that is already sorted is streamed straight into the runs.
+ * Otherwise it is cut into chunks that are radix sorted in parallel on
+ * the compaction scheduler, and the chunks are then merged, the last
+ * first, since it holds the most recent entries. Chunks are merged
+ * from memory, except those past the first LOAD_MEMORY_MAX_ENTRIES
+ * entries, which are spilled to temporary runs as they are sorted.
+ *
+ * A tree with a log but no data directory keeps no record of its runs
+ * to recover from, so loads into it go through put to be logged.
+ */
+
+void LSMTree::load(string file_path) {
+    unique_lock<shared_timed_mutex> lock(levels_lock, defer_lock);
+    vector<load_chunk_t> chunks;
+    vector<shared_ptr<Run>> outputs, written;
+    entry_t batch[MERGE_BATCH_SIZE];
     MergeContext merge_ctx;
-    entry_t entry;
+    struct stat file_stat;
+    const entry_t *input;
+    Buffer *active;
+    Level *level;
+    KEY_t min_key, max_key;
+    long num_entries, num_chunks, output_size, batch_size, i;
+    int fd, target, fallback, c;
+    bool empty;
+
+    check_writable();
+
+    if ((fd = open(file_path.c_str(), O_RDONLY)) == -1) {
+        throw TreeError(LSM_NOT_FOUND, "Could not locate file '" + file_path + "'.");
+    } else if (fstat(fd, &file_stat) == -1) {
+        close(fd);
+        throw TreeError(LSM_IO_ERROR, "Could not read file '" + file_path + "'.");
+    }
 
-    if (end <= start) {
-        cout << endl;
+    // Whatever is left over after the last whole entry is ignored
+    num_entries = file_stat.st_size / sizeof(entry_t);
+
+    if (num_entries == 0) {
+        close(fd);
         return;
-    } else {
-        // Convert to inclusive bound
-        end -= 1;
     }
 
-    /*
-     * Search buffer
-     */
+    input = (const entry_t *)mmap(0, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (input == MAP_FAILED) {
+        throw TreeError(LSM_IO_ERROR, "Could not read file '" + file_path + "'.");
+    }
+
+    // The input stays mapped until the load is done, however it ends
+    auto unmap = [&](const entry_t *mapped) {munmap((void *)mapped, file_stat.st_size);};
+    unique_ptr<const entry_t, decltype(unmap)> mapping(input, unmap);
+
+    madvise((void *)input, file_stat.st_size, MADV_SEQUENTIAL);
+
+    if (wal != nullptr && data_dir.empty()) {
+        for (i = 0; i < num_entries; i++) {
+            put(input[i].key, input[i].val);
+        }
 
-    ranges.insert({0, buffer.range(start, end)});
+        return;
+    }
 
     /*
-     * Search runs
+     * Flush whatever was written before the load, so that it all sits
+     * in runs that the loaded runs can then be put in front of
      */
 
-    counter = 0;
+    buffer_lock.lock_shared();
+    active = buffer.get();
+    empty = (active->size() == 0);
+    buffer_lock.unlock_shared();
 
-    worker_task search = [&] {
-        int current_run;
-        Run *run;
+    if (!empty) freeze_buffer(active);
 
-        current_run = counter++;
+    buffer_lock.lock();
+    flush_group.wait();
+    buffer_lock.unlock();
 
-        if ((run = get_run(current_run)) != nullptr) {
-            lock.lock();
-            ranges.insert({current_run + 1, run->range(start, end)});
-            lock.unlock();
+    check_writable();
 
-            // Potentially more runs to search.
-            search();
+    if (is_sorted(input, input + num_entries)) {
+        min_key = input[0].key;
+        max_key = input[num_entries - 1].key;
+    } else {
+        TaskGroup group(compaction_scheduler);
+
+        num_chunks = (num_entries + LOAD_CHUNK_ENTRIES - 1) / LOAD_CHUNK_ENTRIES;
+        chunks.resize(num_chunks);
+
+        for (c = 0; c < num_chunks; c++) {
+            group.run([&, c] {
+                sort_chunk(input + c * LOAD_CHUNK_ENTRIES,
+                           min((long)LOAD_CHUNK_ENTRIES, num_entries - c * LOAD_CHUNK_ENTRIES),
+                           (long)c * LOAD_CHUNK_ENTRIES >= LOAD_MEMORY_MAX_ENTRIES,
+                           levels.front().page_size, compaction_scheduler, chunks[c]);
+            });
         }
-    };
 
-    worker_pool.launch(search);
-    worker_pool.wait_all();
+        group.wait();
+
+        min_key = KEY_MAX;
+        max_key = KEY_MIN;
+        num_entries = 0;
+
+        for (const auto& chunk : chunks) {
+            min_key = min(min_key, chunk.data()[0].key);
+            max_key = max(max_key, chunk.data()[chunk.size() - 1].key);
+            num_entries += chunk.size();
+        }
+    }
 
     /*
-     * Merge ranges and print keys
+     * Write the runs for the deepest level that can take them now. Into
+     * a leveled level, they are split into files as a merge would.
      */
 
-    for (const auto& kv : ranges) {
-        merge_ctx.add(kv.second->data(), kv.second->size());
-    }
+    levels_lock.lock_shared();
+
+    for (target = levels.size() - 1; !can_ingest(target, min_key, max_key, num_entries); target--);
+
+    levels_lock.unlock_shared();
 
-    while (!merge_ctx.done()) {
-        entry = merge_ctx.next();
-        if (entry.val != VAL_TOMBSTONE) {
-            cout << entry.key << ":" << entry.val;
-            if (!merge_ctx.done()) cout << " ";
+    level = &levels[target];
+    output_size = level->leveled ? levels.front().max_run_size : num_entries;
+
+    auto write = [&](const entry_t& entry) {
+        if (outputs.empty() || outputs.back()->size == output_size) {
+            if (!outputs.empty()) outputs.back()->seal();
+
+            outputs.push_back(make_shared<Run>(output_size, level->page_size,
+                                               level->bf_bits_per_entry, run_write_flags,
+                                               block_cache, new_run_path()));
+            outputs.back()->filter_stats = level->filter_stats;
+            outputs.back()->begin_write();
+        }
+
+        outputs.back()->put(entry);
+    };
+
+    if (chunks.empty()) {
+        for (i = 0; i < num_entries; i++) {
+            if (i + 1 == num_entries || input[i + 1].key != input[i].key) write(input[i]);
+        }
+    } else {
+        for (c = chunks.size() - 1; c >= 0; c--) {
+            merge_ctx.add(chunks[c].data(), chunks[c].size());
+        }
+
+        while ((batch_size = merge_ctx.next(batch, MERGE_BATCH_SIZE)) > 0) {
+            for (i = 0; i < batch_size; i++) write(batch[i]);
         }
     }
 
-    cout << endl;
+    outputs.back()->seal();
+
+    chunks.clear();
+    mapping.reset();
 
     /*
-     * Cleanup subrange vectors
+     * Install the runs, unless the level can no longer take them as
+     * they are, since a flush or merge got there first. They then go to
+     * the deepest level that can take them instead, which level 0
+     * always can, rewritten for it unless they already suit it. A load
+     * that fails before it installs its runs leaves the tree as it was.
      */
 
-    for (auto& range : ranges) {
-        delete range.second;
-    }
-}
+    lock.lock();
 
-void LSMTree::del(KEY_t key) {
-    put(key, VAL_TOMBSTONE);
-}
+    while (!can_ingest(target, min_key, max_key, num_entries)) {
+        for (fallback = target - 1; !can_ingest(fallback, min_key, max_key, num_entries); fallback--);
 
-void LSMTree::load(string file_path) {
-    ifstream stream;
-    entry_t entry;
+        target = fallback;
 
-    stream.open(file_path, ifstream::binary);
+        if (same_shape(*level, levels[target])) {
+            level = &levels[target];
+            for (const auto& run : outputs) run->filter_stats = level->filter_stats;
+            continue;
+        }
 
-    if (stream.is_open()) {
-        while (stream >> entry) {
-            put(entry.key, entry.val);
+        lock.unlock();
+
+        level = &levels[target];
+        output_size = level->leveled ? levels.front().max_run_size : num_entries;
+        written.swap(outputs);
+        outputs.clear();
+
+        for (const auto& run : written) {
+            for (i = 0; i < run->size; i++) write(run->entries()[i]);
         }
+
+        outputs.back()->seal();
+        written.clear();
+
+        lock.lock();
+    }
+
+    if (level->leveled) {
+        level->runs.insert(level->runs.end(), outputs.begin(), outputs.end());
+
+        sort(level->runs.begin(), level->runs.end(),
+             [](const shared_ptr<Run>& a, const shared_ptr<Run>& b) {
+                 return a->min_key < b->min_key;
+             });
     } else {
-        die("Could not locate file '" + file_path + "'.");
+        for (const auto& run : outputs) level->runs.push_front(run);
+    }
+
+    install_version();
+
+    if (!data_dir.empty()) {
+        try {
+            save_manifest();
+        } catch (const TreeError& error) {
+            fail_writes(error);
+            throw;
+        }
     }
+
+    check_capacity(target);
+    schedule_compaction(target);
 }
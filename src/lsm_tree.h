@@ -1,29 +1,147 @@
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
 #include <vector>
 
+#include "block_cache.h"
 #include "buffer.h"
 #include "level.h"
+#include "options.h"
+#include "range_iterator.h"
+#include "scheduler.h"
 #include "spin_lock.h"
+#include "status.h"
 #include "types.h"
-#include "worker_pool.h"
+#include "version.h"
+#include "wal.h"
 
 #define DEFAULT_TREE_DEPTH 5
 #define DEFAULT_TREE_FANOUT 10
 #define DEFAULT_BUFFER_NUM_PAGES 1000
 #define DEFAULT_THREAD_COUNT 4
 #define DEFAULT_BF_BITS_PER_ENTRY 0.5
+#define DEFAULT_COMPACTION_THREAD_COUNT 4
+#define DEFAULT_PIN_THREADS false
+#define DEFAULT_MERGE_POLICY TIERING
+#define DEFAULT_CACHE_NUM_PAGES 1000
+#define DEFAULT_EVICTION_POLICY CLOCK
+#define DEFAULT_PAGE_SIZE 4096
+#define DEFAULT_FILTER_ALLOCATION UNIFORM
+#define DEFAULT_RUN_WRITE_FLAGS 0
+#define DEFAULT_WAL_DURABILITY WAL_PERIODIC
+
+// Write backpressure kicks in once level 0 holds this many times
+// its usual number of runs: first slowing writers, then stopping them
+// until background compaction catches up.
+#define L0_SLOWDOWN_FACTOR 2
+#define L0_STOP_FACTOR 3
+#define WRITE_SLOWDOWN_MS 1
+
+// Merges are split into key ranges of at least this many entries
+// unless told otherwise, which are merged in parallel
+#define DEFAULT_MERGE_PARTITION_MIN_ENTRIES (1 << 20)
+
+// Point lookups fan out over the query threads only when at least
+// this many of the runs they must search have the page they need
+// outside the block cache, unless told otherwise
+#define DEFAULT_GET_PARALLEL_MIN_PAGES 4
+
+// Unsorted input to a load is sorted in chunks of this many entries,
+// in parallel, and the chunks past the first this many entries are
+// spilled to temporary runs rather than held in memory to be merged
+#define LOAD_CHUNK_ENTRIES (1 << 22)
+#define LOAD_MEMORY_MAX_ENTRIES (1 << 25)
+
+/*
+ * How point lookups were answered: from the buffers, by searching runs
+ * on the calling thread, or by searching them on the query threads;
+ * and how many run pages they searched in all
+ */
+
+enum get_path {BUFFER_GET, INLINE_GET, PARALLEL_GET};
+
+struct get_stats {
+    atomic<long> paths[3];
+    atomic<long> pages_searched;
+};
+
+typedef struct get_stats get_stats_t;
 
 class LSMTree {
-    Buffer buffer;
-    WorkerPool worker_pool;
-    float bf_bits_per_entry;
+    shared_ptr<Buffer> buffer, immutable_buffer;
+    Buffer *spare_buffer;
+    SpinLock spare_lock;
+    shared_timed_mutex buffer_lock, levels_lock;
+    condition_variable_any compaction_done;
+    // Compactions and the key ranges they are split into share a
+    // scheduler, so a compaction waiting on its ranges helps merge them
+    Scheduler query_scheduler, flush_scheduler, compaction_scheduler;
+    TaskGroup flush_group;
+    int run_write_flags;
+    long merge_partition_min_entries;
+    int get_parallel_min_pages;
+    // Log of the writes to the buffers, if the tree has one
+    WriteAheadLog *wal;
+    // Directory holding the tree's runs, manifest and logs, if it is
+    // kept on disk; the oldest log holding writes to the active buffer;
+    // and the oldest holding writes that are not yet in a run
+    string data_dir;
+    atomic<uint64_t> next_file_number;
+    uint64_t buffer_log_number, log_number;
+    // Readers search the current version, published whenever the
+    // buffers or runs change
+    shared_ptr<const version_t> current_version;
+    // Sequence number of the last write, and of the most recent live
+    // snapshot (or 0 if there is none)
+    atomic<SEQ_t> last_seq, pinned_seq;
+    mutex snapshots_lock;
+    multiset<SEQ_t> snapshots;
+    BlockCache *block_cache;
     vector<Level> levels;
-    Run * get_run(int);
-    void merge_down(vector<Level>::iterator);
+    size_t l0_slowdown_runs, l0_stop_runs;
+    // Set once the last level overflows, after which writes fail
+    atomic<bool> out_of_space;
+    // Set once a flush or merge fails to write to disk, after which
+    // writes fail too, with the first such error
+    atomic<bool> write_failed;
+    mutex write_error_lock;
+    string write_error;
+    get_stats_t get_counts;
+    void allocate_filter_bits(float);
+    void freeze_buffer(Buffer *);
+    void throttle_writes(void);
+    void flush_buffer(void);
+    shared_ptr<Buffer> share_buffer(Buffer *);
+    void install_version(void);
+    shared_ptr<const version_t> read_version(const Snapshot *, SEQ_t&);
+    void check_capacity(int);
+    void fail_writes(const TreeError&);
+    void check_writable(void);
+    void schedule_compaction(int);
+    void compact(int);
+    void merge_down(int);
+    void record_get(get_path, long);
+    bool can_ingest(int, KEY_t, KEY_t, long) const;
+    string data_file(uint64_t, const char *) const;
+    string new_run_path(void);
+    void open_data_dir(wal_durability);
+    void save_manifest(void);
+    void remove_obsolete_files(bool);
+    void release(void);
 public:
-    LSMTree(int, int, int, int, float);
+    LSMTree(int, int, int, int, int, bool, float, filter_allocation, merge_policy, long,
+            eviction_policy, const vector<long>&, int, string, string, wal_durability, long, int);
+    ~LSMTree(void);
+    long compaction_debt(void);
+    void stats(void);
     void put(KEY_t, VAL_t);
-    void get(KEY_t);
-    void range(KEY_t, KEY_t);
+    void put(const entry_t *, long);
+    shared_ptr<Snapshot> snapshot(void);
+    bool get(KEY_t, VAL_t&, const Snapshot *snapshot = nullptr);
+    long multi_get(const KEY_t *, long, VAL_t *, bool *, const Snapshot *snapshot = nullptr);
+    unique_ptr<RangeIterator> iterator(const Snapshot *snapshot = nullptr);
     void del(KEY_t);
     void load(std::string);
 };
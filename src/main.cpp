@@ -1,64 +1,103 @@
+#include <csignal>
 #include <iostream>
+#include <sstream>
 
+#include "io.h"
 #include "lsm_tree.h"
+#include "protocol.h"
+#include "server.h"
+#include "status.h"
 #include "sys.h"
 #include "unistd.h"
 
 using namespace std;
 
-void command_loop(LSMTree& tree) {
-    char command;
-    KEY_t key_a, key_b;
-    VAL_t val;
-    string file_path;
+/*
+ * Parse a comma-separated list of page sizes in bytes, one per level
+ * from level 0 down.
+ */
 
-    while (cin >> command) {
-        switch (command) {
-        case 'p':
-            cin >> key_a >> val;
+vector<long> parse_page_sizes(string list) {
+    vector<long> page_sizes;
+    stringstream stream(list);
+    string page_size;
 
-            if (val < VAL_MIN || val > VAL_MAX) {
-                die("Could not insert value " + to_string(val) + ": out of range.");
-            } else {
-                tree.put(key_a, val);
-            }
+    while (getline(stream, page_size, ',')) {
+        page_sizes.push_back(atol(page_size.c_str()));
 
-            break;
-        case 'g':
-            cin >> key_a;
-            tree.get(key_a);
-            break;
-        case 'r':
-            cin >> key_a >> key_b;
-            tree.range(key_a, key_b);
-            break;
-        case 'd':
-            cin >> key_a;
-            tree.del(key_a);
-            break;
-        case 'l':
-            cin.ignore();
-            getline(cin, file_path);
-            // Trim quotes
-            tree.load(file_path.substr(1, file_path.size() - 2));
-            break;
-        default:
-            die("Invalid command.");
+        if (page_sizes.back() <= 0 || page_sizes.back() % sizeof(entry_t) != 0) {
+            die("Invalid page size '" + page_size + "': must be a positive "
+                "multiple of " + to_string(sizeof(entry_t)) + " bytes.");
+        }
+    }
+
+    if (page_sizes.empty()) die("No page sizes given.");
+
+    return page_sizes;
+}
+
+/*
+ * Parse a comma-separated list of options for writing runs out
+ */
+
+int parse_write_flags(string list) {
+    stringstream stream(list);
+    string flag;
+    int flags;
+
+    flags = 0;
+
+    while (getline(stream, flag, ',')) {
+        if (flag == "direct") {
+            flags |= RUN_DIRECT_IO;
+        } else if (flag == "sync") {
+            flags |= RUN_SYNC;
+        } else if (flag != "buffered") {
+            die("Unknown write option '" + flag + "'.");
         }
     }
+
+    return flags;
 }
 
 int main(int argc, char *argv[]) {
-    int opt, buffer_num_pages, buffer_max_entries, depth, fanout, num_threads;
+    int opt, buffer_num_pages, buffer_max_entries, depth, fanout, num_threads, num_compaction_threads;
+    bool pin_threads;
     float bf_bits_per_entry;
+    filter_allocation allocation;
+    merge_policy policy;
+    eviction_policy eviction;
+    string policy_name;
+    long cache_num_pages;
+    vector<long> page_sizes;
+    int run_write_flags;
+    string data_dir, log_path;
+    wal_durability durability;
+    bool binary;
+    string socket_path;
+    int port, num_server_threads;
+    sigset_t signals;
+    unique_ptr<LSMTree> tree;
 
     buffer_num_pages = DEFAULT_BUFFER_NUM_PAGES;
     depth = DEFAULT_TREE_DEPTH;
     fanout = DEFAULT_TREE_FANOUT;
     num_threads = DEFAULT_THREAD_COUNT;
+    num_compaction_threads = DEFAULT_COMPACTION_THREAD_COUNT;
+    pin_threads = DEFAULT_PIN_THREADS;
     bf_bits_per_entry = DEFAULT_BF_BITS_PER_ENTRY;
+    allocation = DEFAULT_FILTER_ALLOCATION;
+    policy = DEFAULT_MERGE_POLICY;
+    cache_num_pages = DEFAULT_CACHE_NUM_PAGES;
+    eviction = DEFAULT_EVICTION_POLICY;
+    page_sizes.push_back(DEFAULT_PAGE_SIZE);
+    run_write_flags = DEFAULT_RUN_WRITE_FLAGS;
+    durability = DEFAULT_WAL_DURABILITY;
+    binary = false;
+    port = 0;
+    num_server_threads = DEFAULT_SERVER_THREAD_COUNT;
 
-    while ((opt = getopt(argc, argv, "b:d:f:t:r:")) != -1) {
+    while ((opt = getopt(argc, argv, "b:d:f:t:j:Pr:a:m:c:e:p:w:o:l:D:i:s:S:N:")) != -1) {
         switch (opt) {
         case 'b':
             buffer_num_pages = atoi(optarg);
@@ -72,23 +111,185 @@ int main(int argc, char *argv[]) {
         case 't':
             num_threads = atoi(optarg);
             break;
+        case 'j':
+            num_compaction_threads = atoi(optarg);
+            break;
+        case 'P':
+            pin_threads = true;
+            break;
         case 'r':
             bf_bits_per_entry = atof(optarg);
             break;
+        case 'a':
+            policy_name = optarg;
+
+            if (policy_name == "uniform") {
+                allocation = UNIFORM;
+            } else if (policy_name == "monkey") {
+                allocation = MONKEY;
+            } else {
+                die("Unknown filter allocation '" + policy_name + "'.");
+            }
+
+            break;
+        case 'm':
+            policy_name = optarg;
+
+            if (policy_name == "tiering") {
+                policy = TIERING;
+            } else if (policy_name == "leveling") {
+                policy = LEVELING;
+            } else if (policy_name == "lazy-leveling") {
+                policy = LAZY_LEVELING;
+            } else {
+                die("Unknown merge policy '" + policy_name + "'.");
+            }
+
+            break;
+        case 'c':
+            cache_num_pages = atol(optarg);
+            break;
+        case 'e':
+            policy_name = optarg;
+
+            if (policy_name == "lru") {
+                eviction = LRU;
+            } else if (policy_name == "clock") {
+                eviction = CLOCK;
+            } else {
+                die("Unknown eviction policy '" + policy_name + "'.");
+            }
+
+            break;
+        case 'p':
+            page_sizes = parse_page_sizes(optarg);
+            break;
+        case 'w':
+            run_write_flags = parse_write_flags(optarg);
+            break;
+        case 'o':
+            data_dir = optarg;
+            break;
+        case 'l':
+            log_path = optarg;
+            break;
+        case 'D':
+            policy_name = optarg;
+
+            if (policy_name == "none") {
+                durability = WAL_NONE;
+            } else if (policy_name == "periodic") {
+                durability = WAL_PERIODIC;
+            } else if (policy_name == "batch") {
+                durability = WAL_PER_BATCH;
+            } else {
+                die("Unknown durability '" + policy_name + "'.");
+            }
+
+            break;
+        case 'i':
+            policy_name = optarg;
+
+            if (policy_name == "text") {
+                binary = false;
+            } else if (policy_name == "binary") {
+                binary = true;
+            } else {
+                die("Unknown protocol '" + policy_name + "'.");
+            }
+
+            break;
+        case 's':
+            socket_path = optarg;
+            break;
+        case 'S':
+            port = atoi(optarg);
+            break;
+        case 'N':
+            num_server_threads = atoi(optarg);
+            break;
         default:
             die("Usage: " + string(argv[0]) + " "
                 "[-b number of pages in buffer] "
                 "[-d number of levels] "
                 "[-f level fanout] "
                 "[-t number of threads] "
+                "[-j number of compaction threads] "
+                "[-P pin threads to cores] "
                 "[-r bloom filter bits per entry] "
+                "[-a bloom filter allocation: uniform or monkey] "
+                "[-m merge policy: tiering, leveling or lazy-leveling] "
+                "[-c number of pages in block cache] "
+                "[-e block cache eviction policy: lru or clock] "
+                "[-p page size in bytes, or a comma-separated list of one per level] "
+                "[-w how runs are written: buffered, or any of direct and sync, comma-separated] "
+                "[-o data directory, reopened if it exists] "
+                "[-l write-ahead log file, replayed on startup, if there is no data directory] "
+                "[-D log durability: none, periodic or batch] "
+                "[-i protocol on stdin and stdout: text or binary] "
+                "[-s serve on a Unix domain socket at this path] "
+                "[-S serve on this TCP port on the loopback interface] "
+                "[-N number of server threads] "
                 "<[workload]");
         }
     }
 
+    if (!data_dir.empty() && !log_path.empty()) {
+        die("A data directory keeps its own log.");
+    }
+
+    if (!socket_path.empty() && port != 0) {
+        die("The server listens on either a socket path or a port.");
+    }
+
+    /*
+     * A server runs until it is interrupted or terminated. These signals
+     * are blocked before the tree starts any threads, so that only the
+     * server waits for them, and the tree is then shut down cleanly.
+     */
+
+    if (!socket_path.empty() || port != 0) {
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    }
+
     buffer_max_entries = buffer_num_pages * getpagesize() / sizeof(entry_t);
-    LSMTree tree(buffer_max_entries, depth, fanout, num_threads, bf_bits_per_entry);
-    command_loop(tree);
+
+    /*
+     * The tree reports what goes wrong with it as a TreeError. The tree
+     * is left as it is, since the process exits straight away.
+     */
+
+    try {
+        tree.reset(new LSMTree(buffer_max_entries, depth, fanout, num_threads, num_compaction_threads,
+                               pin_threads, bf_bits_per_entry, allocation, policy,
+                               cache_num_pages * getpagesize(), eviction, page_sizes,
+                               run_write_flags, data_dir, log_path, durability,
+                               DEFAULT_MERGE_PARTITION_MIN_ENTRIES, DEFAULT_GET_PARALLEL_MIN_PAGES));
+
+        if (!socket_path.empty() || port != 0) {
+            Server server(*tree, socket_path, port, num_server_threads);
+
+            server.run();
+            return 0;
+        }
+
+        InputBuffer input(STDIN_FILENO);
+        OutputBuffer output(stdout);
+
+        // Output is flushed when the commands read so far are answered
+        setvbuf(stdout, nullptr, _IOFBF, IO_BUFFER_SIZE);
+
+        if (binary) {
+            binary_command_loop(*tree, input, output);
+        } else {
+            text_command_loop(*tree, input, output);
+        }
+    } catch (const TreeError& error) {
+        die(error.what());
+    }
 
     return 0;
 }
@@ -0,0 +1,107 @@
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+#include "manifest.h"
+#include "status.h"
+#include "sys.h"
+
+using namespace std;
+
+/*
+ * Read the manifest of a data directory. Returns false if there is
+ * none, as in a directory the tree has never been opened in.
+ */
+
+bool read_manifest(const string& dir, manifest_t& manifest) {
+    ifstream stream(dir + "/" + MANIFEST_FILE_NAME);
+    string line, word, name, kind;
+    istringstream line_stream;
+    manifest_level_t level;
+    int version;
+
+    if (!stream.is_open()) {
+        return false;
+    }
+
+    if (!(stream >> word >> version) || word != "manifest" || version != MANIFEST_VERSION
+        || !(stream >> word >> manifest.next_file_number) || word != "next-file"
+        || !(stream >> word >> manifest.log_number) || word != "log") {
+        throw TreeError(LSM_CORRUPTION, "Manifest in '" + dir + "' is corrupt.");
+    }
+
+    manifest.levels.clear();
+    getline(stream, line);
+
+    // One line per level: its kind and shape, then its run files
+    while (getline(stream, line)) {
+        line_stream.clear();
+        line_stream.str(line);
+
+        if (!(line_stream >> word >> kind >> level.max_runs >> level.max_run_size) || word != "level"
+            || (kind != "tiered" && kind != "leveled")) {
+            throw TreeError(LSM_CORRUPTION, "Manifest in '" + dir + "' is corrupt.");
+        }
+
+        level.leveled = (kind == "leveled");
+        level.runs.clear();
+
+        while (line_stream >> name) level.runs.push_back(name);
+
+        manifest.levels.push_back(level);
+    }
+
+    return true;
+}
+
+void write_manifest(const string& dir, const manifest_t& manifest) {
+    string path, tmp_path, contents;
+    ostringstream stream;
+    ssize_t result;
+    size_t written;
+    int fd;
+
+    stream << "manifest " << MANIFEST_VERSION << "\n"
+           << "next-file " << manifest.next_file_number << "\n"
+           << "log " << manifest.log_number << "\n";
+
+    for (const auto& level : manifest.levels) {
+        stream << "level " << (level.leveled ? "leveled" : "tiered")
+               << " " << level.max_runs << " " << level.max_run_size;
+        for (const auto& run : level.runs) stream << " " << run;
+        stream << "\n";
+    }
+
+    contents = stream.str();
+    path = dir + "/" + MANIFEST_FILE_NAME;
+    tmp_path = path + ".tmp";
+
+    if ((fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+        throw TreeError(LSM_IO_ERROR, "Could not create manifest in '" + dir + "'.");
+    }
+
+    written = 0;
+
+    while (written < contents.size()
+           && (result = write(fd, contents.data() + written, contents.size() - written)) > 0) {
+        written += result;
+    }
+
+    // Whatever went wrong, the manifest in place is left as it was
+    if (written < contents.size() || fsync(fd) != 0) {
+        close(fd);
+        remove(tmp_path.c_str());
+        throw TreeError(LSM_IO_ERROR, "Could not write manifest in '" + dir + "'.");
+    }
+
+    close(fd);
+
+    if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+        remove(tmp_path.c_str());
+        throw TreeError(LSM_IO_ERROR, "Could not write manifest in '" + dir + "'.");
+    }
+
+    sync_directory(dir);
+}
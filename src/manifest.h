@@ -0,0 +1,47 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define MANIFEST_FILE_NAME "MANIFEST"
+#define MANIFEST_VERSION 2
+
+using namespace std;
+
+/*
+ * The manifest of a data directory records what the tree holds on disk:
+ * the run files of each level, in the order the level keeps them, and
+ * the oldest write-ahead log that still holds writes not yet in a run.
+ * Each level also records its shape, how many runs of how many entries
+ * it holds, which a tree reopening the directory must share.
+ * Files in the directory are numbered in the order they were created,
+ * and the manifest also records the next number to use.
+ *
+ * The manifest is rewritten whole on every change, to a temporary file
+ * that is then renamed over it, so that it is always either the old or
+ * the new one after a crash.
+ */
+
+struct manifest_level {
+    bool leveled;
+    uint64_t max_runs;
+    int64_t max_run_size;
+    vector<string> runs;
+};
+
+typedef struct manifest_level manifest_level_t;
+
+struct manifest {
+    uint64_t next_file_number;
+    uint64_t log_number;
+    vector<manifest_level_t> levels;
+};
+
+typedef struct manifest manifest_t;
+
+bool read_manifest(const string&, manifest_t&);
+void write_manifest(const string&, const manifest_t&);
+
+#endif
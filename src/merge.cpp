@@ -1,39 +1,171 @@
+#include <algorithm>
 #include <cassert>
-#include <iostream>
+#include <cstring>
 
 #include "merge.h"
 
-void MergeContext::add(entry_t *entries, long num_entries) {
-    merge_entry_t merge_entry;
+// Sort key of an input that has run out, which loses every match
+#define MERGE_EXHAUSTED UINT64_MAX
+
+/*
+ * Pack an entry's key and its input's precedence into a single sort
+ * key, so that matches order first by key, then by recency
+ */
+
+static inline uint64_t sort_key(KEY_t key, int precedence) {
+    return ((uint64_t)((uint32_t)key ^ 0x80000000) << 32) | (uint32_t)precedence;
+}
+
+static inline KEY_t sort_key_key(uint64_t head) {
+    return (KEY_t)((uint32_t)(head >> 32) ^ 0x80000000);
+}
+
+void MergeContext::add(const entry_t *entries, long num_entries) {
+    merge_input_t input;
+
+    assert(!started);
 
     if (num_entries > 0) {
-        merge_entry.entries = entries;
-        merge_entry.num_entries = num_entries;
-        merge_entry.precedence = queue.size();
-        queue.push(merge_entry);
+        input.current = entries;
+        input.end = entries + num_entries;
+        inputs.push_back(input);
+    }
+}
+
+void MergeContext::add(merge_source_t source) {
+    merge_input_t input;
+
+    assert(!started);
+
+    input.source = move(source);
+
+    if (refill(input)) {
+        inputs.push_back(move(input));
     }
 }
 
-entry_t MergeContext::next(void) {
-    merge_entry_t current, next;
-    entry_t entry;
+/*
+ * Move an input on to its next chunk, if it is streamed and has one
+ */
+
+bool MergeContext::refill(merge_input_t& input) {
+    long num_entries;
 
-    current = queue.top();
-    next = current;
+    while (input.source && input.source(input.current, num_entries)) {
+        if (num_entries > 0) {
+            input.end = input.current + num_entries;
+            return true;
+        }
+    }
+
+    return false;
+}
 
-    // Only release the most recent value for a given key
-    while (next.head().key == current.head().key && !queue.empty()) {
-        queue.pop();
+/*
+ * Play the initial tournament. Leaves (the inputs) sit at positions k
+ * to 2k - 1 of an implicit binary tree, and each internal node p plays
+ * the winners of nodes 2p and 2p + 1.
+ */
+
+void MergeContext::start(void) {
+    vector<int> winners;
+    int k, p, left, right;
+
+    started = true;
+    k = inputs.size();
+    num_live = k;
+
+    heads.resize(k);
+    losers.resize(max(k, 1));
+    winners.resize(2 * k);
+
+    for (p = 0; p < k; p++) {
+        heads[p] = sort_key(inputs[p].current->key, p);
+        winners[k + p] = p;
+    }
 
-        next.current_index++;
-        if (!next.done()) queue.push(next);
+    for (p = k - 1; p >= 1; p--) {
+        left = winners[2 * p];
+        right = winners[2 * p + 1];
 
-        next = queue.top();
+        winners[p] = (heads[left] < heads[right]) ? left : right;
+        losers[p] = (heads[left] < heads[right]) ? right : left;
     }
 
-    return current.head();
+    losers[0] = (k > 1) ? winners[1] : 0;
+}
+
+/*
+ * Move the winner on to its next entry, and replay its path to the
+ * root to find the new winner
+ */
+
+void MergeContext::advance(int winner) {
+    int p;
+
+    if (++inputs[winner].current == inputs[winner].end && !refill(inputs[winner])) {
+        heads[winner] = MERGE_EXHAUSTED;
+        num_live--;
+    } else {
+        heads[winner] = sort_key(inputs[winner].current->key, winner);
+    }
+
+    for (p = (inputs.size() + winner) / 2; p >= 1; p /= 2) {
+        if (heads[losers[p]] < heads[winner]) {
+            swap(losers[p], winner);
+        }
+    }
+
+    losers[0] = winner;
+}
+
+/*
+ * Write up to max_entries merged entries to output, and return how many
+ * were written. Older entries for a key that has been written are
+ * skipped.
+ */
+
+long MergeContext::next(entry_t *output, long max_entries) {
+    merge_input_t *input;
+    long num_entries, count;
+    KEY_t key;
+    int winner;
+
+    if (!started) start();
+
+    num_entries = 0;
+
+    while (num_entries < max_entries && num_live > 0) {
+        winner = losers[0];
+        input = &inputs[winner];
+
+        if (num_live == 1) {
+            // Keys are unique within an input, so copy the rest of it
+            // straight to the output
+            count = min(max_entries - num_entries, (long)(input->end - input->current));
+            memcpy(output + num_entries, input->current, count * sizeof(entry_t));
+            num_entries += count;
+            input->current += count;
+
+            if (input->current == input->end && !refill(*input)) num_live--;
+            continue;
+        }
+
+        key = input->current->key;
+        output[num_entries++] = *input->current;
+
+        // Only release the most recent value for a given key
+        do {
+            advance(winner);
+            winner = losers[0];
+        } while (heads[winner] != MERGE_EXHAUSTED && sort_key_key(heads[winner]) == key);
+    }
+
+    return num_entries;
 }
 
 bool MergeContext::done(void) {
-    return queue.empty();
+    if (!started) start();
+
+    return num_live == 0;
 }
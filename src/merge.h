@@ -1,34 +1,56 @@
-#include <cassert>
-#include <queue>
+#include <cstdint>
+#include <functional>
+#include <vector>
 
 #include "types.h"
 
+// Number of entries callers take from a merge at a time
+#define MERGE_BATCH_SIZE 1024
+
 using namespace std;
 
-struct merge_entry {
-    int precedence;
-    entry_t *entries;
-    long num_entries;
-    int current_index = 0;
-    entry_t head(void) const {return entries[current_index];}
-    bool done(void) const {return current_index == num_entries;}
-    bool operator>(const merge_entry& other) const {
-        // Order first by keys, then by precedence
-        if (head() == other.head()) {
-            assert(precedence != other.precedence);
-            return precedence > other.precedence;
-        } else {
-            return head() > other.head();
-        }
-    }
+// Hands out the next chunk of a streamed input, returning false once
+// there are no more. A chunk must stay valid until the next call.
+typedef function<bool(const entry_t *&, long&)> merge_source_t;
+
+struct merge_input {
+    const entry_t *current;
+    const entry_t *end;
+    merge_source_t source;
 };
 
-typedef struct merge_entry merge_entry_t;
+typedef struct merge_input merge_input_t;
+
+/*
+ * k-way merge of sorted inputs, each holding at most one entry per key,
+ * into a single sorted stream that holds only the most recent entry for
+ * each key. Inputs are added from most to least recent.
+ *
+ * The inputs play a tournament in a loser tree: each internal node holds
+ * the input that lost the match played there, and the overall winner is
+ * kept at the root. Taking an entry from the winner only replays the
+ * matches on its path to the root, which is log2(k) comparisons against
+ * a single array of packed sort keys. Once a single input is left, its
+ * entries are copied out directly.
+ *
+ * An input is either an array, or a source that streams it in chunks,
+ * so that inputs too big to hold in memory can be merged a piece at a
+ * time.
+ */
 
 class MergeContext {
-    priority_queue<merge_entry_t, vector<merge_entry_t>, greater<merge_entry_t>> queue;
+    vector<merge_input_t> inputs;
+    vector<uint64_t> heads;
+    vector<int> losers;
+    int num_live;
+    bool started;
+    void start(void);
+    void advance(int);
+    bool refill(merge_input_t&);
 public:
-    void add(entry_t *, long);
-    entry_t next(void);
+    MergeContext(void) : num_live(0), started(false) {}
+    void add(const entry_t *, long);
+    void add(merge_source_t);
+    long next(entry_t *, long);
     bool done(void);
 };
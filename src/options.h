@@ -0,0 +1,58 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <string>
+#include <vector>
+
+// Part of the library's public interface, so it leaves the std
+// namespace to those who include it
+
+enum merge_policy {TIERING, LEVELING, LAZY_LEVELING};
+enum filter_allocation {UNIFORM, MONKEY};
+enum eviction_policy {LRU, CLOCK};
+
+/*
+ * How much a write survives once put returns. It is always written to
+ * the log, so it survives the process crashing; with no durability,
+ * that is all; with periodic durability, it is also synced within
+ * WAL_SYNC_INTERVAL_MS, to survive the machine crashing; and with
+ * per-batch durability, put waits for it to be synced.
+ */
+
+enum wal_durability {WAL_NONE, WAL_PERIODIC, WAL_PER_BATCH};
+
+/*
+ * The shape of a tree and how it runs, for opening one as a library.
+ * Every option starts out at its default; sizes are in bytes, except
+ * for the buffer's, which is in entries. The tree is kept in memory
+ * unless given a data directory or a log.
+ */
+
+struct lsm_options {
+    long buffer_max_entries;
+    int depth, fanout;
+    int num_threads, num_compaction_threads;
+    bool pin_threads;
+    float bf_bits_per_entry;
+    filter_allocation allocation;
+    merge_policy policy;
+    long cache_size;
+    eviction_policy eviction;
+    // One per level from level 0 down; deeper levels take the last
+    std::vector<long> page_sizes;
+    // RUN_DIRECT_IO and RUN_SYNC, from run.h
+    int run_write_flags;
+    std::string data_dir, log_path;
+    wal_durability durability;
+    // Merges are split into key ranges of at least this many entries,
+    // which are merged in parallel
+    long merge_partition_min_entries;
+    // Gets search runs on the query threads at once only when at least
+    // this many of the runs have the page they need outside the cache
+    int get_parallel_min_pages;
+    lsm_options(void);
+};
+
+typedef struct lsm_options lsm_options_t;
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef PAGE_SEARCH_H
+#define PAGE_SEARCH_H
+
+#include "types.h"
+
+/*
+ * Searches within a single page of a run, whose entries are sorted by
+ * key. Both are branchless binary searches: each step halves the range
+ * with a conditional move rather than a branch the CPU would mispredict
+ * half the time, and the loop runs a fixed log2(n) steps.
+ */
+
+// Return the first entry whose key is at least the search key, or
+// page + num_entries if there is none.
+inline const entry_t * page_lower_bound(const entry_t *page, long num_entries, KEY_t key) {
+    const entry_t *base;
+    long half;
+
+    if (num_entries == 0) {
+        return page;
+    }
+
+    base = page;
+
+    while (num_entries > 1) {
+        half = num_entries / 2;
+        base = (base[half].key < key) ? base + half : base;
+        num_entries -= half;
+    }
+
+    return base + (base->key < key);
+}
+
+// Return the entry with the search key, or nullptr if there is none.
+inline const entry_t * page_find(const entry_t *page, long num_entries, KEY_t key) {
+    const entry_t *base;
+    long half;
+
+    if (num_entries == 0) {
+        return nullptr;
+    }
+
+    base = page;
+
+    while (num_entries > 1) {
+        half = num_entries / 2;
+        base = (base[half].key <= key) ? base + half : base;
+        num_entries -= half;
+    }
+
+    return (base->key == key) ? base : nullptr;
+}
+
+#endif
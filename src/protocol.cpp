@@ -0,0 +1,332 @@
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "lsm_tree.h"
+#include "protocol.h"
+#include "status.h"
+#include "sys.h"
+
+using namespace std;
+
+/*
+ * Binary protocol
+ */
+
+static void put_header(OutputBuffer& out, uint8_t op, uint8_t status, uint32_t count) {
+    protocol_header_t header;
+
+    header.op = op;
+    header.status = status;
+    header.reserved = 0;
+    header.count = count;
+
+    out.put(&header, sizeof(header));
+}
+
+/*
+ * The size of the payload that follows a request header, or -1 if the
+ * header is not that of a request
+ */
+
+long request_payload_size(const protocol_header_t& header) {
+    long item_size;
+
+    switch (header.op) {
+    case OP_PUT:
+        item_size = sizeof(entry_t);
+        break;
+    case OP_RANGE:
+        item_size = 2 * sizeof(KEY_t);
+        break;
+    case OP_DELETE:
+    case OP_GET:
+        item_size = sizeof(KEY_t);
+        break;
+    case OP_LOAD:
+        item_size = 1;
+        break;
+    default:
+        return -1;
+    }
+
+    if (header.count * item_size > PROTOCOL_MAX_PAYLOAD) {
+        return -1;
+    }
+
+    return header.count * item_size;
+}
+
+RangeResponse::RangeResponse(LSMTree& tree, const protocol_header_t& header, const char *payload) :
+                             tree(tree), bounds(2 * header.count), next_range(0)
+{
+    memcpy(bounds.data(), payload, bounds.size() * sizeof(KEY_t));
+    frame.reserve(PROTOCOL_RANGE_FRAME_ENTRIES);
+}
+
+RangeResponse::~RangeResponse(void) {}
+
+/*
+ * Write the next frame, and return whether there are more to come
+ */
+
+bool RangeResponse::write_frame(OutputBuffer& out) {
+    bool more;
+
+    if (next_range == bounds.size() / 2) {
+        return false;
+    }
+
+    if (it == nullptr) {
+        it = tree.iterator();
+        it->set_upper_bound(bounds[2 * next_range + 1]);
+        it->seek(bounds[2 * next_range]);
+    }
+
+    frame.clear();
+
+    for (; it->valid() && frame.size() < PROTOCOL_RANGE_FRAME_ENTRIES; it->next()) {
+        frame.push_back(it->entry());
+    }
+
+    more = it->valid();
+
+    put_header(out, OP_RANGE, more ? PROTOCOL_MORE : PROTOCOL_OK, frame.size());
+    out.put(frame.data(), frame.size() * sizeof(entry_t));
+
+    if (!more) {
+        it = nullptr;
+        next_range++;
+    }
+
+    return next_range < bounds.size() / 2;
+}
+
+/*
+ * Carry out a request, given its header and payload, and write out the
+ * response. The payload need not be aligned.
+ */
+
+static void execute(LSMTree& tree, const protocol_header_t& header, const char *payload,
+                    OutputBuffer& out) {
+    vector<entry_t> entries;
+    vector<KEY_t> keys;
+    unique_ptr<bool[]> found;
+    vector<VAL_t> vals;
+    unique_ptr<RangeResponse> ranges;
+    uint32_t i;
+
+    switch (header.op) {
+    case OP_PUT:
+        entries.resize(header.count);
+        memcpy(entries.data(), payload, header.count * sizeof(entry_t));
+
+        for (const auto& entry : entries) {
+            if (entry.val < VAL_MIN || entry.val > VAL_MAX) {
+                put_header(out, header.op, PROTOCOL_INVALID, 0);
+                return;
+            }
+        }
+
+        tree.put(entries.data(), entries.size());
+        put_header(out, header.op, PROTOCOL_OK, header.count);
+        break;
+    case OP_DELETE:
+        entries.resize(header.count);
+
+        for (i = 0; i < header.count; i++) {
+            memcpy(&entries[i].key, payload + i * sizeof(KEY_t), sizeof(KEY_t));
+            entries[i].val = VAL_TOMBSTONE;
+        }
+
+        tree.put(entries.data(), entries.size());
+        put_header(out, header.op, PROTOCOL_OK, header.count);
+        break;
+    case OP_GET:
+        keys.resize(header.count);
+        memcpy(keys.data(), payload, header.count * sizeof(KEY_t));
+        vals.resize(header.count);
+        found.reset(new bool[header.count]);
+
+        // A batch of keys is looked up all at once
+        if (header.count == 1) {
+            found[0] = tree.get(keys[0], vals[0]);
+        } else {
+            tree.multi_get(keys.data(), header.count, vals.data(), found.get());
+        }
+
+        for (i = 0; i < header.count; i++) {
+            if (!found[i]) vals[i] = PROTOCOL_NOT_FOUND;
+        }
+
+        put_header(out, header.op, PROTOCOL_OK, header.count);
+        out.put(vals.data(), vals.size() * sizeof(VAL_t));
+        break;
+    case OP_RANGE:
+        ranges.reset(new RangeResponse(tree, header, payload));
+        while (ranges->write_frame(out)) {}
+        break;
+    case OP_LOAD:
+        tree.load(string(payload, header.count));
+        put_header(out, header.op, PROTOCOL_OK, 0);
+        break;
+    }
+}
+
+void execute_request(LSMTree& tree, const protocol_header_t& header, const char *payload,
+                     OutputBuffer& out) {
+    try {
+        execute(tree, header, payload, out);
+    } catch (const TreeError&) {
+        put_header(out, header.op, PROTOCOL_FAILED, 0);
+    }
+}
+
+/*
+ * Answer binary requests until the input ends. Responses are only
+ * flushed once every request read so far is answered, so that a batch
+ * of requests sent together is answered together.
+ */
+
+void binary_command_loop(LSMTree& tree, InputBuffer& in, OutputBuffer& out) {
+    protocol_header_t header;
+    const char *bytes;
+    long payload_size;
+
+    while (true) {
+        if (in.buffered() == 0) out.flush();
+
+        if ((bytes = in.read_bytes(sizeof(header))) == nullptr) {
+            if (in.buffered() > 0) die("Truncated request.");
+            break;
+        }
+
+        memcpy(&header, bytes, sizeof(header));
+
+        if ((payload_size = request_payload_size(header)) < 0) {
+            die("Invalid request.");
+        } else if ((bytes = in.read_bytes(payload_size)) == nullptr) {
+            die("Truncated request.");
+        }
+
+        execute_request(tree, header, bytes, out);
+    }
+
+    out.flush();
+}
+
+/*
+ * Text protocol
+ */
+
+static KEY_t read_key(InputBuffer& in) {
+    long key;
+
+    if (!in.read_long(key) || key < KEY_MIN || key > KEY_MAX) {
+        die("Invalid key.");
+    }
+
+    return key;
+}
+
+/*
+ * Answer text commands until the input ends, one per line: the command,
+ * then its arguments. Output is flushed whenever the commands read so
+ * far are all answered, rather than after every line.
+ */
+
+void text_command_loop(LSMTree& tree, InputBuffer& in, OutputBuffer& out) {
+    vector<KEY_t> keys;
+    vector<VAL_t> vals;
+    unique_ptr<bool[]> found;
+    unique_ptr<RangeIterator> it;
+    KEY_t key_a, key_b;
+    VAL_t val_found;
+    string file_path;
+    long val;
+    size_t i;
+    int command;
+    bool first;
+
+    while (true) {
+        in.skip_buffered_space();
+        if (in.buffered() == 0) out.flush();
+
+        if ((command = in.next()) == EOF) {
+            break;
+        }
+
+        switch (command) {
+        case 'p':
+            key_a = read_key(in);
+
+            if (!in.read_long(val)) {
+                die("Invalid value.");
+            } else if (val < VAL_MIN || val > VAL_MAX) {
+                die("Could not insert value " + to_string(val) + ": out of range.");
+            } else {
+                tree.put(key_a, val);
+            }
+
+            break;
+        case 'g':
+            key_a = read_key(in);
+
+            if (tree.get(key_a, val_found)) out.put_long(val_found);
+            out.put('\n');
+            break;
+        case 'm':
+            // Keys run to the end of the line
+            keys.clear();
+
+            while (!in.at_line_end()) keys.push_back(read_key(in));
+
+            vals.resize(keys.size());
+            found.reset(new bool[keys.size()]);
+            tree.multi_get(keys.data(), keys.size(), vals.data(), found.get());
+
+            for (i = 0; i < keys.size(); i++) {
+                if (found[i]) out.put_long(vals[i]);
+                out.put('\n');
+            }
+
+            break;
+        case 'r':
+            key_a = read_key(in);
+            key_b = read_key(in);
+            first = true;
+
+            if (key_a < key_b) {
+                it = tree.iterator();
+                it->set_upper_bound(key_b);
+
+                for (it->seek(key_a); it->valid(); it->next()) {
+                    if (!first) out.put(' ');
+                    out.put_long(it->entry().key);
+                    out.put(':');
+                    out.put_long(it->entry().val);
+                    first = false;
+                }
+            }
+
+            out.put('\n');
+            break;
+        case 'd':
+            tree.del(read_key(in));
+            break;
+        case 'l':
+            in.get();
+            file_path = in.read_line();
+            // Trim quotes
+            tree.load(file_path.substr(1, file_path.size() - 2));
+            break;
+        case 's':
+            tree.stats();
+            break;
+        default:
+            die("Invalid command.");
+        }
+    }
+
+    out.flush();
+}
@@ -0,0 +1,86 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "io.h"
+#include "types.h"
+
+// Requests with a longer payload are rejected
+#define PROTOCOL_MAX_PAYLOAD (1 << 24)
+
+// The value a get response holds for a key that was not found
+#define PROTOCOL_NOT_FOUND VAL_TOMBSTONE
+
+// Range responses come in frames of at most this many entries
+#define PROTOCOL_RANGE_FRAME_ENTRIES (1 << 12)
+
+using namespace std;
+
+/*
+ * Binary protocol: requests and responses are frames, each a header
+ * followed by a payload of count items, with every number in host byte
+ * order. Each request takes a batch of items:
+ *
+ *   request  payload                  response
+ *   put      count entries            header, with the count put
+ *   delete   count keys               header, with the count deleted
+ *   get      count keys               header, then a value for each key,
+ *                                     or PROTOCOL_NOT_FOUND
+ *   range    count (start, end) keys  for each range, the entries in
+ *                                     it, in frames: a header, then up
+ *                                     to PROTOCOL_RANGE_FRAME_ENTRIES
+ *                                     entries
+ *   load     count bytes of a path    header
+ *
+ * Every frame of a range but its last has the status PROTOCOL_MORE, so
+ * the last, which may be empty, marks its end. Requests are answered in
+ * order. A request that is well formed but
+ * invalid, such as a put of the value reserved for deletes, is answered
+ * with PROTOCOL_INVALID and not carried out. One the tree fails to carry
+ * out, such as a load of a file that does not exist, or a write once the
+ * tree is full, is answered with PROTOCOL_FAILED alone.
+ */
+
+enum protocol_op {OP_PUT = 'p', OP_DELETE = 'd', OP_GET = 'g', OP_RANGE = 'r', OP_LOAD = 'l'};
+enum protocol_status {PROTOCOL_OK, PROTOCOL_INVALID, PROTOCOL_FAILED, PROTOCOL_MORE};
+
+struct protocol_header {
+    uint8_t op;
+    uint8_t status;
+    uint16_t reserved;
+    uint32_t count;
+};
+
+typedef struct protocol_header protocol_header_t;
+
+class LSMTree;
+class RangeIterator;
+
+/*
+ * The response to a range request, written out a frame at a time, so
+ * that only a frame's worth of entries is held in memory however many
+ * the ranges hold. Each range is read as of when its first frame is
+ * written.
+ */
+
+class RangeResponse {
+    LSMTree& tree;
+    vector<KEY_t> bounds;
+    size_t next_range;
+    unique_ptr<RangeIterator> it;
+    vector<entry_t> frame;
+public:
+    RangeResponse(LSMTree&, const protocol_header_t&, const char *);
+    ~RangeResponse(void);
+    bool write_frame(OutputBuffer&);
+};
+
+long request_payload_size(const protocol_header_t&);
+void execute_request(LSMTree&, const protocol_header_t&, const char *, OutputBuffer&);
+void binary_command_loop(LSMTree&, InputBuffer&, OutputBuffer&);
+void text_command_loop(LSMTree&, InputBuffer&, OutputBuffer&);
+
+#endif
@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include "radix_sort.h"
+
+using namespace std;
+
+static inline uint32_t digit(KEY_t key, int shift) {
+    // Flipping the sign bit orders signed keys as unsigned
+    return (((uint32_t)key ^ 0x80000000u) >> shift) & (RADIX_SORT_BUCKETS - 1);
+}
+
+/*
+ * Keep only the last of each run of entries with the same key, in place
+ */
+
+static long keep_last(entry_t *entries, long num_entries) {
+    long i, kept;
+
+    kept = 0;
+
+    for (i = 0; i < num_entries; i++) {
+        if (i + 1 == num_entries || entries[i + 1].key != entries[i].key) {
+            entries[kept++] = entries[i];
+        }
+    }
+
+    return kept;
+}
+
+/*
+ * Run a task for every block, the first on the calling thread and the
+ * rest on the scheduler
+ */
+
+static void for_each_block(int num_blocks, Scheduler *scheduler, function<void(int)> task) {
+    int b;
+
+    if (num_blocks == 1) {
+        task(0);
+        return;
+    }
+
+    TaskGroup group(*scheduler);
+
+    for (b = 1; b < num_blocks; b++) {
+        group.run([&task, b] {task(b);});
+    }
+
+    task(0);
+    group.wait();
+}
+
+long radix_sort(entry_t *entries, long num_entries, entry_t *scratch, Scheduler *scheduler) {
+    vector<vector<long>> offsets;
+    vector<long> kept;
+    entry_t *from, *to;
+    long block_size, total, count, d;
+    int num_blocks, shift, b;
+    bool shared;
+
+    if (num_entries < RADIX_SORT_MIN_ENTRIES) {
+        stable_sort(entries, entries + num_entries);
+        return keep_last(entries, num_entries);
+    }
+
+    num_blocks = 1;
+
+    if (scheduler != nullptr) {
+        num_blocks = max(1L, min((long)scheduler->size(), num_entries / RADIX_SORT_MIN_BLOCK_ENTRIES));
+    }
+
+    block_size = (num_entries + num_blocks - 1) / num_blocks;
+    offsets.assign(num_blocks, vector<long>(RADIX_SORT_BUCKETS));
+
+    auto block_start = [&](int b) {return min(num_entries, b * block_size);};
+
+    from = entries;
+    to = scratch;
+
+    for (shift = 0; shift < (int)(8 * sizeof(KEY_t)); shift += RADIX_SORT_BITS) {
+        for_each_block(num_blocks, scheduler, [&](int b) {
+            vector<long>& counts = offsets[b];
+            long i;
+
+            fill(counts.begin(), counts.end(), 0);
+
+            for (i = block_start(b); i < block_start(b + 1); i++) {
+                counts[digit(from[i].key, shift)]++;
+            }
+        });
+
+        /*
+         * Turn the counts into where each block writes each digit: after
+         * the smaller digits, and after the blocks before it
+         */
+
+        total = 0;
+        shared = false;
+
+        for (d = 0; d < RADIX_SORT_BUCKETS; d++) {
+            count = 0;
+
+            for (b = 0; b < num_blocks; b++) {
+                count += offsets[b][d];
+                offsets[b][d] = total + count - offsets[b][d];
+            }
+
+            total += count;
+            shared |= (count == num_entries);
+        }
+
+        if (shared) continue;
+
+        for_each_block(num_blocks, scheduler, [&](int b) {
+            long *next = offsets[b].data();
+            long i;
+
+            for (i = block_start(b); i < block_start(b + 1); i++) {
+                to[next[digit(from[i].key, shift)]++] = from[i];
+            }
+        });
+
+        swap(from, to);
+    }
+
+    if (from == entries) {
+        return keep_last(entries, num_entries);
+    }
+
+    /*
+     * Copy the last entry for each key back, every block to just after
+     * what the blocks before it keep
+     */
+
+    kept.assign(num_blocks + 1, 0);
+
+    if (num_blocks > 1) {
+        for_each_block(num_blocks, scheduler, [&](int b) {
+            long i, j;
+
+            j = 0;
+
+            for (i = block_start(b); i < block_start(b + 1); i++) {
+                if (i + 1 == num_entries || from[i + 1].key != from[i].key) j++;
+            }
+
+            kept[b + 1] = j;
+        });
+
+        for (b = 0; b < num_blocks; b++) kept[b + 1] += kept[b];
+    }
+
+    for_each_block(num_blocks, scheduler, [&](int b) {
+        long i, j;
+
+        j = kept[b];
+
+        for (i = block_start(b); i < block_start(b + 1); i++) {
+            if (i + 1 == num_entries || from[i + 1].key != from[i].key) entries[j++] = from[i];
+        }
+
+        // A single block has not been counted
+        if (num_blocks == 1) kept[1] = j;
+    });
+
+    return kept[num_blocks];
+}
@@ -0,0 +1,35 @@
+#ifndef RADIX_SORT_H
+#define RADIX_SORT_H
+
+#include "scheduler.h"
+#include "types.h"
+
+// Keys are sorted on digits of this many bits, least significant first,
+// so 32-bit keys take three passes
+#define RADIX_SORT_BITS 11
+#define RADIX_SORT_BUCKETS (1 << RADIX_SORT_BITS)
+
+// Fewer entries than this are sorted by comparison instead
+#define RADIX_SORT_MIN_ENTRIES 256
+
+// Each block of a parallel sort holds at least this many entries
+#define RADIX_SORT_MIN_BLOCK_ENTRIES (1 << 16)
+
+/*
+ * Sort entries by key, keeping only the last entry for each key, as if
+ * they had been put in order. Returns how many entries are left.
+ *
+ * LSD radix sort: every pass scatters the entries by one digit of their
+ * key into scratch space, which must hold as many entries, and back. The
+ * passes are stable, so the entries for a key stay in the order they
+ * were given, and the last is kept while copying them back after the
+ * final pass. Passes over a digit that every key shares are skipped.
+ *
+ * Given a scheduler, each pass is split into blocks of the entries that
+ * are counted and scattered in parallel, each block after the ones
+ * before it within every bucket.
+ */
+
+long radix_sort(entry_t *, long, entry_t *, Scheduler *scheduler = nullptr);
+
+#endif
@@ -0,0 +1,173 @@
+#include <cstdint>
+
+#include "buffer.h"
+#include "merge.h"
+#include "page_search.h"
+#include "range_iterator.h"
+#include "run.h"
+
+/*
+ * Cursors hand out the entries of a buffer or run in a key range, in
+ * key order, one chunk at a time
+ */
+
+class RangeCursor {
+public:
+    virtual ~RangeCursor(void) {};
+    virtual bool next_chunk(const entry_t *&, long&) = 0;
+};
+
+class BufferCursor : public RangeCursor {
+    const Buffer *buffer;
+    KEY_t next_key, end;
+    SEQ_t seq;
+    bool exhausted;
+    entry_t chunk[RANGE_CURSOR_CHUNK_SIZE];
+public:
+    BufferCursor(const Buffer *buffer, KEY_t start, KEY_t end, SEQ_t seq) :
+                 buffer(buffer), next_key(start), end(end), seq(seq), exhausted(false) {}
+    bool next_chunk(const entry_t *&, long&);
+};
+
+bool BufferCursor::next_chunk(const entry_t *& entries, long& num_entries) {
+    if (exhausted) {
+        return false;
+    }
+
+    num_entries = buffer->scan(next_key, end, chunk, RANGE_CURSOR_CHUNK_SIZE, seq);
+    entries = chunk;
+
+    // Resume after the last key copied, unless there can be nothing
+    // left to copy
+    if (num_entries < RANGE_CURSOR_CHUNK_SIZE || chunk[num_entries - 1].key == end) {
+        exhausted = true;
+    } else {
+        next_key = chunk[num_entries - 1].key + 1;
+    }
+
+    return num_entries > 0;
+}
+
+class RunCursor : public RangeCursor {
+    const Run *run;
+    KEY_t start, end;
+    long page_index, pages_read;
+public:
+    RunCursor(const Run *, KEY_t, KEY_t);
+    bool next_chunk(const entry_t *&, long&);
+};
+
+RunCursor::RunCursor(const Run *run, KEY_t start, KEY_t end) :
+                     run(run), start(start), end(end), pages_read(0)
+{
+    page_index = (start < run->fences().front()) ? 0 : run->page_of(start);
+}
+
+bool RunCursor::next_chunk(const entry_t *& entries, long& num_entries) {
+    const entry_t *page, *page_end, *last;
+
+    if (page_index >= run->num_pages()) {
+        return false;
+    }
+
+    page = run->read_page(page_index, pages_read < BLOCK_CACHE_MAX_SCAN_PAGES, num_entries);
+    page_end = page + num_entries;
+    pages_read++;
+
+    // Only the first page can hold keys before the start of the range
+    entries = (pages_read == 1) ? page_lower_bound(page, num_entries, start) : page;
+    last = (end == KEY_MAX) ? page_end : page_lower_bound(page, num_entries, end + 1);
+
+    // A page that holds keys past the end of the range is the last
+    page_index = (last < page_end) ? run->num_pages() : page_index + 1;
+
+    num_entries = last - entries;
+
+    return true;
+}
+
+/*
+ * Range iterator
+ */
+
+RangeIterator::RangeIterator(shared_ptr<const version_t> version, SEQ_t seq) :
+                             version(version), seq(seq), batch_size(0), position(0),
+                             end_key((long)KEY_MAX + 1) {}
+
+RangeIterator::~RangeIterator(void) {}
+
+void RangeIterator::set_upper_bound(KEY_t end) {
+    end_key = end;
+}
+
+/*
+ * Position the iterator at the first live entry whose key is at least
+ * start. Seeking again starts over.
+ */
+
+void RangeIterator::seek(KEY_t start) {
+    KEY_t end;
+
+    cursors.clear();
+    merge_ctx.reset(new MergeContext);
+    batch_size = 0;
+    position = 0;
+
+    if (start >= end_key) {
+        return;
+    }
+
+    end = end_key - 1;
+
+    // Buffers are more recent than runs, and the active buffer than
+    // the immutable one
+    cursors.emplace_back(new BufferCursor(version->buffer.get(), start, end, seq));
+
+    if (version->immutable_buffer != nullptr) {
+        cursors.emplace_back(new BufferCursor(version->immutable_buffer.get(), start, end, seq));
+    }
+
+    for (const auto& run : version->runs) {
+        if (run->overlaps(start, end)) {
+            cursors.emplace_back(new RunCursor(run.get(), start, end));
+        }
+    }
+
+    for (const auto& cursor : cursors) {
+        RangeCursor *c = cursor.get();
+        merge_ctx->add([c](const entry_t *& entries, long& num_entries) {
+            return c->next_chunk(entries, num_entries);
+        });
+    }
+
+    skip_tombstones();
+}
+
+void RangeIterator::next(void) {
+    position++;
+    skip_tombstones();
+}
+
+/*
+ * Move on to the next entry that is not a tombstone, merging the next
+ * batch if this one runs out
+ */
+
+void RangeIterator::skip_tombstones(void) {
+    while (true) {
+        while (position < batch_size && batch[position].val == VAL_TOMBSTONE) {
+            position++;
+        }
+
+        if (position < batch_size) {
+            return;
+        }
+
+        batch_size = merge_ctx->next(batch, RANGE_ITERATOR_BATCH_SIZE);
+        position = 0;
+
+        if (batch_size == 0) {
+            return;
+        }
+    }
+}
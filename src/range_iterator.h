@@ -0,0 +1,55 @@
+#ifndef RANGE_ITERATOR_H
+#define RANGE_ITERATOR_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "types.h"
+#include "version.h"
+
+// Number of merged entries an iterator reads ahead at a time
+#define RANGE_ITERATOR_BATCH_SIZE 256
+
+// Number of entries a buffer cursor copies out of the buffer at a time
+#define RANGE_CURSOR_CHUNK_SIZE 256
+
+using namespace std;
+
+class MergeContext;
+class RangeCursor;
+
+/*
+ * Streams the live entries of a version of the tree in key order, from
+ * a starting key given to seek up to an optional exclusive upper bound.
+ * Deleted keys are skipped, as are buffered writes made after the
+ * sequence number read at.
+ *
+ * The buffers and runs are each read through a cursor that holds at
+ * most a chunk of the buffer or a single page of the run, and the
+ * cursors are merged lazily, a small batch at a time. However wide the
+ * range, an iterator holds a bounded amount of memory, and stopping
+ * early reads no further. The iterator holds on to its version, so the
+ * tree carries on flushing and merging while it is open.
+ */
+
+class RangeIterator {
+    shared_ptr<const version_t> version;
+    SEQ_t seq;
+    vector<unique_ptr<RangeCursor>> cursors;
+    unique_ptr<MergeContext> merge_ctx;
+    entry_t batch[RANGE_ITERATOR_BATCH_SIZE];
+    long batch_size, position;
+    long end_key;
+    void skip_tombstones(void);
+public:
+    RangeIterator(shared_ptr<const version_t>, SEQ_t);
+    ~RangeIterator(void);
+    void set_upper_bound(KEY_t);
+    void seek(KEY_t);
+    bool valid(void) const {return position < batch_size;}
+    const entry_t& entry(void) const {return batch[position];}
+    void next(void);
+};
+
+#endif
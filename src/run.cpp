@@ -1,159 +1,522 @@
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cstdio>
+#include <cstring>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "page_search.h"
 #include "run.h"
+#include "status.h"
 
 using namespace std;
 
-Run::Run(long max_size, float bf_bits_per_entry) :
+static atomic<uint32_t> next_run_id(0);
+
+Run::Run(long max_size, long page_size, float bf_bits_per_entry, int write_flags,
+         BlockCache *block_cache, string path) :
+         bloom_filter(max_size, bf_bits_per_entry),
+         write_flags(write_flags),
+         block_cache(block_cache),
          max_size(max_size),
-         bloom_filter(max_size * bf_bits_per_entry)
+         page_size(page_size)
 {
     char *tmp_fn;
 
+    id = next_run_id++;
     size = 0;
-    fence_pointers.reserve(max_size / getpagesize());
-
-    tmp_fn = strdup(TMP_FILE_PATTERN);
-    tmp_file = mktemp(tmp_fn);
+    min_key = KEY_MAX;
+    max_key = KEY_MIN;
+    fence_pointers.reserve(max_size / entries_per_page() + 1);
+
+    if (path.empty()) {
+        tmp_fn = strdup(TMP_FILE_PATTERN);
+        file_path = mktemp(tmp_fn);
+        free(tmp_fn);
+    } else {
+        file_path = path;
+    }
 
+    keep_file = false;
     mapping = nullptr;
-    mapping_fd = -1;
+    fd = -1;
+    writer = nullptr;
+}
+
+// Whether count items of item_size bytes at offset end by limit
+static bool fits(uint64_t offset, uint64_t count, uint64_t item_size, uint64_t limit) {
+    return offset <= limit && count <= (limit - offset) / item_size;
+}
+
+/*
+ * Check a footer read from a run file of the given length against the
+ * layout seal writes: the entries from the start of the file, then a
+ * fence pointer for each page of them, then the filter, all ending
+ * before the footer
+ */
+
+static bool footer_valid(const run_footer_t& footer, uint64_t file_length) {
+    uint64_t limit, data_length;
+    int64_t entries_per_page;
+
+    limit = file_length - sizeof(footer);
+
+    if (footer.magic != RUN_FOOTER_MAGIC || footer.size < 0 || footer.size > footer.max_size
+        || footer.page_size < (int64_t)sizeof(entry_t)
+        || !fits(0, footer.size, sizeof(entry_t), limit)) {
+        return false;
+    }
+
+    data_length = (footer.size * sizeof(entry_t) + RUN_FOOTER_ALIGNMENT - 1)
+                  & ~(uint64_t)(RUN_FOOTER_ALIGNMENT - 1);
+    entries_per_page = footer.page_size / sizeof(entry_t);
+
+    return footer.fences_offset == data_length
+           && footer.num_fences == (uint64_t)((footer.size + entries_per_page - 1) / entries_per_page)
+           && fits(footer.fences_offset, footer.num_fences, sizeof(KEY_t), limit)
+           && footer.filter_offset % (BLOOM_FILTER_BLOCK_BITS / 8) == 0
+           && footer.filter_blocks > 0 && footer.filter_probes >= 0
+           && fits(footer.filter_offset, footer.filter_blocks, BLOOM_FILTER_BLOCK_BITS / 8, limit);
+}
+
+/*
+ * Open a sealed run from its file. Only the footer is read: the
+ * entries and filter stay in the mapping, and only the fence pointers,
+ * one key per page, are copied out of it. A footer that does not fit
+ * the file marks the run as corrupt.
+ */
+
+Run::Run(string path, BlockCache *block_cache) :
+         bloom_filter(0, 0),
+         write_flags(0),
+         block_cache(block_cache)
+{
+    run_footer_t footer;
+    struct stat file_stat;
+    const KEY_t *fences;
+    ssize_t result;
+
+    id = next_run_id++;
+    file_path = path;
+    keep_file = true;
+    writer = nullptr;
+
+    fd = open(file_path.c_str(), O_RDONLY);
+
+    if (fd == -1 || fstat(fd, &file_stat) == -1 || file_stat.st_size < (off_t)sizeof(footer)) {
+        if (fd != -1) close(fd);
+        throw TreeError(LSM_IO_ERROR, "Could not open run '" + file_path + "'.");
+    }
+
+    mapping_length = file_stat.st_size;
+    result = pread(fd, &footer, sizeof(footer), mapping_length - sizeof(footer));
+
+    if (result != sizeof(footer) || !footer_valid(footer, mapping_length)) {
+        close(fd);
+        throw TreeError(LSM_CORRUPTION, "Run '" + file_path + "' is corrupt.");
+    }
+
+    size = footer.size;
+    max_size = footer.max_size;
+    page_size = footer.page_size;
+    min_key = footer.min_key;
+    max_key = footer.max_key;
+
+    mapping = (entry_t *)mmap(0, mapping_length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    fd = -1;
+
+    if (mapping == MAP_FAILED) {
+        throw TreeError(LSM_IO_ERROR, "Could not map run '" + file_path + "'.");
+    }
+
+    fences = (const KEY_t *)((char *)mapping + footer.fences_offset);
+    fence_pointers.assign(fences, fences + footer.num_fences);
+
+    bloom_filter.map((const uint64_t *)((char *)mapping + footer.filter_offset),
+                     footer.filter_blocks, footer.filter_probes);
 }
 
 Run::~Run(void) {
-    assert(mapping == nullptr);
-    remove(tmp_file.c_str());
+    if (mapping != nullptr) {
+        munmap(mapping, mapping_length);
+    }
+
+    // A run abandoned before it was sealed
+    delete writer;
+
+    if (fd != -1) close(fd);
+
+    if (!keep_file) remove(file_path.c_str());
 }
 
-entry_t * Run::map_read(size_t len, off_t offset) {
-    assert(mapping == nullptr);
+/*
+ * Create the file for the run, to be written out through put, in large
+ * sequential writes. Direct I/O falls back to the page cache on file
+ * systems that do not support it.
+ */
+
+void Run::begin_write(void) {
+    assert(fd == -1);
 
-    mapping_length = len;
+    if (write_flags & RUN_DIRECT_IO) {
+        fd = open(file_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_DIRECT, 0600);
+    }
 
-    mapping_fd = open(tmp_file.c_str(), O_RDONLY);
-    assert(mapping_fd != -1);
+    if (fd == -1) {
+        fd = open(file_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        write_flags &= ~RUN_DIRECT_IO;
+    }
 
-    mapping = (entry_t *)mmap(0, mapping_length, PROT_READ, MAP_SHARED, mapping_fd, offset);
-    assert(mapping != MAP_FAILED);
+    if (fd == -1) {
+        throw TreeError(LSM_IO_ERROR, "Could not create run '" + file_path + "'.");
+    }
 
-    return mapping;
+    writer = new RunWriter(fd, 0, write_flags & RUN_DIRECT_IO);
 }
 
-entry_t * Run::map_read(void) {
-    map_read(max_size * sizeof(entry_t), 0);
-    return mapping;
+/*
+ * Return a writer for the part of the run that starts at the given
+ * entry position, to be filled through put. Writers for disjoint parts
+ * of a run may be used from several threads at once. Each must be
+ * flushed before the run is sealed, and the parts must then be packed
+ * together, which also sizes the run.
+ */
+
+unique_ptr<RunWriter> Run::writer_at(long position) {
+    int flags;
+
+    assert(writer != nullptr);
+
+    // Writes that start part way through the file cannot
+    // meet the alignment that direct I/O requires
+    if (write_flags & RUN_DIRECT_IO) {
+        flags = fcntl(fd, F_GETFL);
+        fcntl(fd, F_SETFL, flags & ~O_DIRECT);
+    }
+
+    return unique_ptr<RunWriter>(new RunWriter(fd, position, false));
 }
 
-entry_t * Run::map_write(void) {
-    assert(mapping == nullptr);
-    int result;
+/*
+ * Finish writing the run, with its footer, and map it read-only for
+ * the rest of its lifetime, so that lookups, range queries and merges
+ * (from any number of threads) read it directly, without any system
+ * calls.
+ *
+ * Direct I/O pads the last write of the entries, but only up to the
+ * page boundary where the footer starts. A run that fails to be written
+ * out is left unsealed, to be thrown away.
+ */
+
+void Run::seal(void) {
+    assert(fd != -1);
+
+    writer->flush();
+    delete writer;
+    writer = nullptr;
+
+    // Runs written in parts through writer_at only learn
+    // where their pages start once they are complete
+    if (fence_pointers.empty() && size > 0) {
+        read_fences();
+    }
 
-    mapping_length = max_size * sizeof(entry_t);
+    mapping_length = write_footer();
 
-    mapping_fd = open(tmp_file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
-    assert(mapping_fd != -1);
+    if (ftruncate(fd, mapping_length) == -1
+        || ((write_flags & RUN_SYNC) && fdatasync(fd) == -1)) {
+        throw TreeError(LSM_IO_ERROR, "Could not write run '" + file_path + "'.");
+    }
 
-    // Set the file to the appropriate length
-    result = lseek(mapping_fd, mapping_length - 1, SEEK_SET);
-    assert(result != -1);
-    result = write(mapping_fd, "", 1);
-    assert(result != -1);
+    mapping = (entry_t *)mmap(0, mapping_length, PROT_READ, MAP_SHARED, fd, 0);
 
-    mapping = (entry_t *)mmap(0, mapping_length, PROT_WRITE, MAP_SHARED, mapping_fd, 0);
-    assert(mapping != MAP_FAILED);
+    if (mapping == MAP_FAILED) {
+        mapping = nullptr;
+        throw TreeError(LSM_IO_ERROR, "Could not map run '" + file_path + "'.");
+    }
 
-    return mapping;
+    // The mapping keeps its own reference to the file
+    close(fd);
+    fd = -1;
 }
 
-void Run::unmap(void) {
-    assert(mapping != nullptr);
+void Run::read_fences(void) {
+    entry_t *entries;
+    long i;
 
-    munmap(mapping, mapping_length);
-    close(mapping_fd);
+    entries = (entry_t *)mmap(0, size * sizeof(entry_t), PROT_READ, MAP_SHARED, fd, 0);
 
-    mapping = nullptr;
-    mapping_length = 0;
-    mapping_fd = -1;
+    if (entries == MAP_FAILED) {
+        throw TreeError(LSM_IO_ERROR, "Could not map run '" + file_path + "'.");
+    }
+
+    for (i = 0; i < size; i += entries_per_page()) {
+        fence_pointers.push_back(entries[i].key);
+    }
+
+    min_key = entries[0].key;
+    max_key = entries[size - 1].key;
+
+    munmap(entries, size * sizeof(entry_t));
 }
 
-VAL_t * Run::get(KEY_t key) {
-    vector<KEY_t>::iterator next_page;
-    long page_index;
-    VAL_t *val;
-    int i;
+static void read_at(int fd, void *data, size_t length, off_t offset) {
+    ssize_t result;
+    size_t done;
+
+    done = 0;
 
-    val = nullptr;
+    while (done < length) {
+        result = pread(fd, (char *)data + done, length - done, offset + done);
 
-    if (key < fence_pointers[0] || key > max_key || !bloom_filter.is_set(key)) {
-        return val;
+        if (result <= 0) {
+            throw TreeError(LSM_IO_ERROR, "Could not read run.");
+        }
+
+        done += result;
     }
+}
 
-    next_page = upper_bound(fence_pointers.begin(), fence_pointers.end(), key);
-    page_index = (next_page - fence_pointers.begin()) - 1;
-    assert(page_index >= 0);
+static void write_at(int fd, const void *data, size_t length, off_t offset) {
+    ssize_t result;
+    size_t written;
 
-    map_read(getpagesize(), page_index * getpagesize());
+    written = 0;
 
-    for (i = 0; i < getpagesize() / sizeof(entry_t); i++) {
-        if (mapping[i].key == key) {
-            val = new VAL_t;
-            *val = mapping[i].val;
+    while (written < length) {
+        result = pwrite(fd, (const char *)data + written, length - written, offset + written);
+
+        if (result <= 0) {
+            throw TreeError(LSM_IO_ERROR, "Could not write run.");
         }
+
+        written += result;
     }
+}
 
-    unmap();
+/*
+ * Move the parts of the run written through writer_at, each starting at
+ * the given entry position and holding the given number of entries, up
+ * against each other in order from the start of the run, and size the
+ * run to hold them. Parts must come in the order of their positions, and
+ * none may overlap the next. Moving a part towards the front a chunk at
+ * a time, from its front, never overwrites what is yet to be moved.
+ */
+
+void Run::pack(const vector<long>& positions, const vector<long>& sizes) {
+    vector<entry_t> chunk;
+    long packed, moved, length;
+    size_t j;
+
+    assert(writer != nullptr);
+
+    packed = 0;
+
+    for (j = 0; j < positions.size(); j++) {
+        for (moved = 0; positions[j] > packed && moved < sizes[j]; moved += length) {
+            length = min((long)(RUN_WRITE_BUFFER_SIZE / sizeof(entry_t)), sizes[j] - moved);
+            chunk.resize(length);
+
+            read_at(fd, chunk.data(), length * sizeof(entry_t),
+                    (positions[j] + moved) * sizeof(entry_t));
+            write_at(fd, chunk.data(), length * sizeof(entry_t),
+                     (packed + moved) * sizeof(entry_t));
+        }
+
+        packed += sizes[j];
+    }
+
+    size = packed;
+}
+
+/*
+ * Write the footer after the entries, and return the length of the
+ * whole file
+ */
 
-    return val;
+size_t Run::write_footer(void) {
+    run_footer_t footer;
+    int flags;
+
+    // The footer is not written in aligned blocks
+    if (write_flags & RUN_DIRECT_IO) {
+        flags = fcntl(fd, F_GETFL);
+        fcntl(fd, F_SETFL, flags & ~O_DIRECT);
+    }
+
+    memset(&footer, 0, sizeof(footer));
+    footer.magic = RUN_FOOTER_MAGIC;
+    footer.size = size;
+    footer.max_size = max_size;
+    footer.page_size = page_size;
+    footer.min_key = min_key;
+    footer.max_key = max_key;
+
+    footer.fences_offset = (size * sizeof(entry_t) + RUN_FOOTER_ALIGNMENT - 1)
+                           & ~(uint64_t)(RUN_FOOTER_ALIGNMENT - 1);
+    footer.num_fences = fence_pointers.size();
+
+    footer.filter_offset = (footer.fences_offset + footer.num_fences * sizeof(KEY_t)
+                            + BLOOM_FILTER_BLOCK_BITS / 8 - 1) & ~(uint64_t)(BLOOM_FILTER_BLOCK_BITS / 8 - 1);
+    footer.filter_blocks = bloom_filter.blocks();
+    footer.filter_probes = bloom_filter.probes();
+
+    write_at(fd, fence_pointers.data(), footer.num_fences * sizeof(KEY_t), footer.fences_offset);
+    write_at(fd, bloom_filter.data(), footer.filter_blocks * BLOOM_FILTER_BLOCK_BITS / 8,
+             footer.filter_offset);
+    write_at(fd, &footer, sizeof(footer),
+             footer.filter_offset + footer.filter_blocks * BLOOM_FILTER_BLOCK_BITS / 8);
+
+    return footer.filter_offset + footer.filter_blocks * BLOOM_FILTER_BLOCK_BITS / 8 + sizeof(footer);
 }
 
-vector<entry_t> * Run::range(KEY_t start, KEY_t end) {
-    vector<entry_t> *subrange;
-    vector<KEY_t>::iterator next_page;
-    long subrange_page_start, subrange_page_end, num_pages, num_entries, i;
+/*
+ * Return the entries in a page of the run, and how many there are.
+ * The page is always read from the mapping; with a block cache, the
+ * read is counted as a hit or a miss, and on a miss the page is added
+ * to the cache only if fill is set.
+ */
 
-    subrange = new vector<entry_t>;
+const entry_t * Run::read_page(long page_index, bool fill, long& num_entries) const {
+    // The last page of a run that is not full is only partly used
+    num_entries = min(entries_per_page(), size - page_index * entries_per_page());
 
-    // If the ranges don't overlap, return an empty vector
-    if (start > max_key || fence_pointers[0] > end) {
-        return subrange;
+    if (block_cache != nullptr && !block_cache->lookup(id, page_index) && fill) {
+        block_cache->insert(id, page_index, num_entries * sizeof(entry_t));
     }
 
-    if (start < fence_pointers[0]) {
-        subrange_page_start = 0;
+    return mapping + page_index * entries_per_page();
+}
+
+/*
+ * Point lookups come in two steps, so that the tree can decide where
+ * to search a run once it knows whether the run may hold the key at
+ * all: first the key range and Bloom filter are checked, and then the
+ * one page that would hold the key is searched.
+ */
+
+bool Run::may_contain(KEY_t key) const {
+    if (!overlaps(key, key)) {
+        return false;
+    } else if (!bloom_filter.is_set(key)) {
+        if (filter_stats != nullptr) filter_stats->negatives.fetch_add(1, memory_order_relaxed);
+        return false;
     } else {
-        next_page = upper_bound(fence_pointers.begin(), fence_pointers.end(), start);
-        subrange_page_start = (next_page - fence_pointers.begin()) - 1;
+        return true;
     }
+}
 
-    if (end > max_key) {
-        subrange_page_end = fence_pointers.size();
+long Run::page_of(KEY_t key) const {
+    vector<KEY_t>::const_iterator next_page;
+    long page_index;
+
+    next_page = upper_bound(fence_pointers.begin(), fence_pointers.end(), key);
+    page_index = (next_page - fence_pointers.begin()) - 1;
+    assert(page_index >= 0);
+
+    return page_index;
+}
+
+bool Run::get_from_page(long page_index, KEY_t key, VAL_t& val) const {
+    long num_entries;
+    const entry_t *page, *entry;
+
+    page = read_page(page_index, true, num_entries);
+
+    if ((entry = page_find(page, num_entries, key)) == nullptr) {
+        if (filter_stats != nullptr) filter_stats->false_positives.fetch_add(1, memory_order_relaxed);
+        return false;
     } else {
-        next_page = upper_bound(fence_pointers.begin(), fence_pointers.end(), end);
-        subrange_page_end = next_page - fence_pointers.begin();
+        val = entry->val;
+        return true;
+    }
+}
+
+/*
+ * Look up a batch of keys, sorted in ascending order, setting found[i]
+ * and vals[i] for each keys[i] in the run, and return how many were
+ * found. The keys are filtered together through the Bloom filter, and
+ * those that pass are grouped by page, so each page is read only once.
+ */
+
+long Run::multi_get(const KEY_t *keys, long num_keys, VAL_t *vals, bool *found) const {
+    vector<KEY_t>::const_iterator next_page;
+    unique_ptr<bool[]> passed;
+    long first, last, page_index, num_entries, num_found, i;
+    const entry_t *page, *entry;
+
+    // Only keys within the run's key range need be looked at
+    first = std::lower_bound(keys, keys + num_keys, min_key) - keys;
+    last = std::upper_bound(keys, keys + num_keys, max_key) - keys;
+
+    if (size == 0 || first >= last) {
+        return 0;
     }
 
-    assert(subrange_page_start < subrange_page_end);
-    num_pages = subrange_page_end - subrange_page_start;
-    map_read(num_pages * getpagesize(), subrange_page_start * getpagesize());
+    passed.reset(new bool[last - first]);
+    bloom_filter.is_set(keys + first, last - first, passed.get());
 
-    num_entries = num_pages * getpagesize() / sizeof(entry_t);
-    subrange->reserve(num_entries);
+    num_found = 0;
+    i = first;
 
-    for (i = 0; i < num_entries; i++) {
-        if (start <= mapping[i].key && mapping[i].key <= end) {
-            subrange->push_back(mapping[i]);
+    while (i < last) {
+        if (!passed[i - first]) {
+            if (filter_stats != nullptr) filter_stats->negatives.fetch_add(1, memory_order_relaxed);
+            i++;
+            continue;
         }
+
+        next_page = upper_bound(fence_pointers.begin(), fence_pointers.end(), keys[i]);
+        page_index = (next_page - fence_pointers.begin()) - 1;
+        page = read_page(page_index, true, num_entries);
+
+        // Look up every key that falls in this page
+        for (; i < last && (next_page == fence_pointers.end() || keys[i] < *next_page); i++) {
+            if (!passed[i - first]) {
+                if (filter_stats != nullptr) filter_stats->negatives.fetch_add(1, memory_order_relaxed);
+            } else if ((entry = page_find(page, num_entries, keys[i])) != nullptr) {
+                vals[i] = entry->val;
+                found[i] = true;
+                num_found++;
+            } else if (filter_stats != nullptr) {
+                filter_stats->false_positives.fetch_add(1, memory_order_relaxed);
+            }
+        }
+    }
+
+    return num_found;
+}
+
+/*
+ * Return the number of entries in the run whose keys are less than the
+ * given key, which is also the position of the first entry whose key
+ * is at least the given key.
+ */
+
+long Run::rank(KEY_t key) const {
+    vector<KEY_t>::const_iterator next_page;
+    long page_index, num_entries;
+    const entry_t *page;
+
+    if (size == 0 || key <= min_key) {
+        return 0;
+    } else if (key > max_key) {
+        return size;
     }
 
-    unmap();
+    next_page = upper_bound(fence_pointers.begin(), fence_pointers.end(), key);
+    page_index = (next_page - fence_pointers.begin()) - 1;
+
+    page = mapping + page_index * entries_per_page();
+    num_entries = min(entries_per_page(), size - page_index * entries_per_page());
 
-    return subrange;
+    return page_lower_bound(page, num_entries, key) - mapping;
 }
 
 void Run::put(entry_t entry) {
@@ -161,14 +524,25 @@ void Run::put(entry_t entry) {
 
     bloom_filter.set(entry.key);
 
-    if (size % getpagesize() == 0) {
+    // Fence the first key of every page
+    if (size % entries_per_page() == 0) {
         fence_pointers.push_back(entry.key);
     }
 
-    // Set a final fence pointer to establish an upper
-    // bound on the last page range.
+    // Keep the key range of the run, which also establishes
+    // an upper bound on the last page range.
+    min_key = min(entry.key, min_key);
     max_key = max(entry.key, max_key);
 
-    mapping[size] = entry;
+    writer->append(entry);
     size++;
 }
+
+/*
+ * Write an entry through a writer returned by writer_at
+ */
+
+void Run::put(RunWriter& region_writer, entry_t entry) {
+    bloom_filter.set_concurrent(entry.key);
+    region_writer.append(entry);
+}
@@ -1,30 +1,96 @@
+#include <memory>
+#include <unistd.h>
 #include <vector>
 
 #include "types.h"
+#include "block_cache.h"
 #include "bloom_filter.h"
+#include "run_writer.h"
 
 #define TMP_FILE_PATTERN "/tmp/lsm-XXXXXX"
 
+// Run files end in a footer that holds the run's fence pointers and
+// Bloom filter, starting on the first page boundary after its entries
+#define RUN_FOOTER_MAGIC 0x31306e75726d736cULL
+#define RUN_FOOTER_ALIGNMENT 4096
+
+// How runs are written out: bypassing the page cache with direct I/O,
+// and syncing each run to disk before it becomes part of the tree
+#define RUN_DIRECT_IO 1
+#define RUN_SYNC 2
+
+// Range scans only fill the block cache with the first this many pages
+// they read from a run, so that wide scans do not flush out the blocks
+// that point lookups depend on
+#define BLOCK_CACHE_MAX_SCAN_PAGES 4
+
 using namespace std;
 
+/*
+ * The end of a run file, which says where the rest of the footer is:
+ * after the entries, the fence pointers, then the filter table, aligned
+ * to a cache line, then this.
+ */
+
+struct run_footer {
+    uint64_t magic;
+    int64_t size, max_size, page_size;
+    KEY_t min_key, max_key;
+    uint64_t fences_offset, num_fences;
+    uint64_t filter_offset, filter_blocks;
+    int32_t filter_probes;
+};
+
+typedef struct run_footer run_footer_t;
+
+/*
+ * A sorted run of entries in a file of its own. Runs are either
+ * written out through put and then sealed, or opened from a file
+ * written and sealed before, in which case the entries, fence pointers
+ * and filter are all read straight from the mapped file.
+ *
+ * Run files are temporary unless given a path, and are removed when
+ * the run is destroyed unless keep_file is set.
+ */
+
 class Run {
     BloomFilter bloom_filter;
     vector<KEY_t> fence_pointers;
-    KEY_t max_key;
     entry_t *mapping;
     size_t mapping_length;
-    int mapping_fd;
-    long file_size() {return max_size * sizeof(entry_t);}
+    int fd;
+    int write_flags;
+    RunWriter *writer;
+    BlockCache *block_cache;
+    long entries_per_page(void) const {return page_size / sizeof(entry_t);}
+    void read_fences(void);
+    size_t write_footer(void);
 public:
-    long size, max_size;
-    string tmp_file;
-    Run(long, float);
+    uint32_t id;
+    long size, max_size, page_size;
+    KEY_t min_key, max_key;
+    string file_path;
+    bool keep_file;
+    shared_ptr<bloom_filter_stats_t> filter_stats;
+    Run(long, long, float, int, BlockCache *, string path = "");
+    Run(string, BlockCache *);
     ~Run(void);
-    entry_t * map_read(size_t, off_t);
-    entry_t * map_read(void);
-    entry_t * map_write(void);
-    void unmap(void);
-    VAL_t * get(KEY_t);
-    vector<entry_t> * range(KEY_t, KEY_t);
+    void begin_write(void);
+    unique_ptr<RunWriter> writer_at(long);
+    void pack(const vector<long>&, const vector<long>&);
+    void seal(void);
+    const entry_t * entries(void) const {return mapping;}
+    const vector<KEY_t>& fences(void) const {return fence_pointers;}
+    long num_pages(void) const {return fence_pointers.size();}
+    const entry_t * read_page(long, bool, long&) const;
+    long rank(KEY_t) const;
+    bool may_contain(KEY_t) const;
+    long page_of(KEY_t) const;
+    bool cached(long page_index) const {return block_cache != nullptr && block_cache->contains(id, page_index);}
+    bool get_from_page(long, KEY_t, VAL_t&) const;
+    bool get(KEY_t key, VAL_t& val) const {return may_contain(key) && get_from_page(page_of(key), key, val);}
+    long multi_get(const KEY_t *, long, VAL_t *, bool *) const;
     void put(entry_t);
+    void put(RunWriter&, entry_t);
+    bool overlaps(KEY_t start, KEY_t end) const {return size > 0 && start <= max_key && min_key <= end;}
 };
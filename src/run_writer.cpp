@@ -0,0 +1,55 @@
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "run_writer.h"
+#include "status.h"
+
+RunWriter::RunWriter(int fd, long position, bool direct) :
+                     fd(fd), position(position), direct(direct), num_buffered(0)
+{
+    assert(!direct || position == 0);
+
+    capacity = RUN_WRITE_BUFFER_SIZE / sizeof(entry_t);
+    buffer = (entry_t *)aligned_alloc(RUN_WRITE_ALIGNMENT, RUN_WRITE_BUFFER_SIZE);
+    assert(buffer != nullptr);
+}
+
+RunWriter::~RunWriter(void) {
+    free(buffer);
+}
+
+/*
+ * Write out everything buffered so far
+ */
+
+void RunWriter::flush(void) {
+    size_t length, written;
+    ssize_t result;
+
+    length = num_buffered * sizeof(entry_t);
+
+    if (direct) {
+        // Only the last write of a run can be partial
+        written = (length + RUN_WRITE_ALIGNMENT - 1) & ~(RUN_WRITE_ALIGNMENT - 1);
+        memset((char *)buffer + length, 0, written - length);
+        length = written;
+    }
+
+    written = 0;
+
+    while (written < length) {
+        result = pwrite(fd, (char *)buffer + written, length - written,
+                        position * sizeof(entry_t) + written);
+
+        if (result <= 0) {
+            throw TreeError(LSM_IO_ERROR, "Could not write run.");
+        }
+
+        written += result;
+    }
+
+    position += num_buffered;
+    num_buffered = 0;
+}
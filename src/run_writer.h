@@ -0,0 +1,41 @@
+#ifndef RUN_WRITER_H
+#define RUN_WRITER_H
+
+#include "types.h"
+
+// Entries are written out in chunks of this many bytes, aligned for
+// direct I/O
+#define RUN_WRITE_BUFFER_SIZE (1 << 20)
+#define RUN_WRITE_ALIGNMENT 4096
+
+/*
+ * Buffered writer that appends entries to a file from a given entry
+ * position onwards, in large writes of its own. Several writers may
+ * write to disjoint parts of the same file at once.
+ *
+ * With direct I/O, every write is a whole number of aligned blocks, so
+ * the writer must start at the beginning of the file, and the last write
+ * is padded; the file must be truncated to its real length afterwards.
+ * Anything still buffered when the writer is destroyed is discarded.
+ */
+
+class RunWriter {
+    int fd;
+    long position;
+    bool direct;
+    entry_t *buffer;
+    long num_buffered;
+    long capacity;
+public:
+    RunWriter(int, long, bool);
+    RunWriter(const RunWriter&) = delete;
+    RunWriter& operator=(const RunWriter&) = delete;
+    ~RunWriter(void);
+    void append(const entry_t& entry) {
+        buffer[num_buffered++] = entry;
+        if (num_buffered == capacity) flush();
+    }
+    void flush(void);
+};
+
+#endif
@@ -0,0 +1,238 @@
+#include <cassert>
+#include <pthread.h>
+#include <sched.h>
+
+#include "scheduler.h"
+
+thread_local Scheduler *Scheduler::current_scheduler = nullptr;
+thread_local int Scheduler::current_worker = -1;
+
+Scheduler::Scheduler(int num_threads, bool pin) :
+                     num_queued(0), num_sleeping(0), next_worker(0), stop(false)
+{
+    int i;
+
+    for (i = 0; i < num_threads; i++) {
+        workers.emplace_back(new struct worker);
+    }
+
+    // Start the threads only once every deque exists to steal from
+    for (i = 0; i < num_threads; i++) {
+        workers[i]->handle = thread(&Scheduler::work, this, i, pin);
+    }
+}
+
+Scheduler::~Scheduler(void) {
+    {
+        lock_guard<mutex> lock(sleep_lock);
+        stop = true;
+    }
+
+    wake.notify_all();
+
+    for (auto& worker : workers) {
+        worker->handle.join();
+    }
+}
+
+void Scheduler::submit(worker_task task, TaskGroup *group) {
+    scheduled_task_t *scheduled;
+    int index;
+
+    scheduled = new scheduled_task_t{move(task), group};
+
+    // A worker keeps the tasks it spawns, so they run on its core
+    // unless someone else is idle
+    if (current_scheduler == this) {
+        index = current_worker;
+    } else if (workers.empty()) {
+        // Nobody to run it but the caller
+        execute(scheduled);
+        return;
+    } else {
+        index = next_worker++ % workers.size();
+    }
+
+    workers[index]->lock.lock();
+    workers[index]->tasks.push_back(scheduled);
+    workers[index]->lock.unlock();
+
+    // Pairs with the check a worker makes before sleeping, so that
+    // either it sees the task or we see it asleep
+    num_queued++;
+
+    if (num_sleeping > 0) {
+        lock_guard<mutex> lock(sleep_lock);
+        wake.notify_one();
+    }
+}
+
+scheduled_task_t * Scheduler::pop(int index) {
+    scheduled_task_t *scheduled;
+    struct worker *worker;
+
+    worker = workers[index].get();
+    scheduled = nullptr;
+
+    worker->lock.lock();
+
+    if (!worker->tasks.empty()) {
+        scheduled = worker->tasks.back();
+        worker->tasks.pop_back();
+    }
+
+    worker->lock.unlock();
+
+    return scheduled;
+}
+
+/*
+ * Take the oldest task from another worker, trying each in turn
+ * starting after the thief
+ */
+
+scheduled_task_t * Scheduler::steal(int thief) {
+    scheduled_task_t *scheduled;
+    struct worker *victim;
+    size_t i;
+
+    for (i = 1; i <= workers.size(); i++) {
+        victim = workers[(thief + i) % workers.size()].get();
+
+        victim->lock.lock();
+
+        if (!victim->tasks.empty()) {
+            scheduled = victim->tasks.front();
+            victim->tasks.pop_front();
+            victim->lock.unlock();
+            return scheduled;
+        }
+
+        victim->lock.unlock();
+    }
+
+    return nullptr;
+}
+
+void Scheduler::execute(scheduled_task_t *scheduled) {
+    if (scheduled->group == nullptr) {
+        scheduled->task();
+    } else {
+        try {
+            scheduled->task();
+        } catch (...) {
+            scheduled->group->fail(current_exception());
+        }
+
+        scheduled->group->finish();
+    }
+
+    delete scheduled;
+}
+
+/*
+ * Run a single task if there is one to take, from the calling worker's
+ * own deque first. Threads from outside the scheduler steal.
+ */
+
+bool Scheduler::run_one(void) {
+    scheduled_task_t *scheduled;
+
+    if (workers.empty()) {
+        return false;
+    } else if (current_scheduler == this) {
+        scheduled = pop(current_worker);
+        if (scheduled == nullptr) scheduled = steal(current_worker);
+    } else {
+        scheduled = steal(next_worker % workers.size());
+    }
+
+    if (scheduled == nullptr) {
+        return false;
+    }
+
+    num_queued--;
+    execute(scheduled);
+
+    return true;
+}
+
+void Scheduler::work(int index, bool pin) {
+    cpu_set_t cpus;
+    int round;
+
+    current_scheduler = this;
+    current_worker = index;
+
+    if (pin) {
+        CPU_ZERO(&cpus);
+        CPU_SET(index % thread::hardware_concurrency(), &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+
+    while (true) {
+        if (run_one()) continue;
+
+        for (round = 0; round < SCHEDULER_SPIN_ROUNDS && num_queued == 0; round++) {
+            this_thread::yield();
+        }
+
+        if (num_queued > 0) continue;
+
+        unique_lock<mutex> lock(sleep_lock);
+
+        num_sleeping++;
+        wake.wait(lock, [this] {return stop || num_queued > 0;});
+        num_sleeping--;
+
+        // Finish whatever is left before stopping
+        if (stop && num_queued == 0) return;
+    }
+}
+
+void TaskGroup::run(worker_task task) {
+    pending++;
+    scheduler.submit(move(task), this);
+}
+
+void TaskGroup::fail(exception_ptr task_error) {
+    lock_guard<mutex> lock(done_lock);
+
+    if (error == nullptr) error = task_error;
+}
+
+void TaskGroup::finish(void) {
+    if (--pending == 0) {
+        lock_guard<mutex> lock(done_lock);
+        finished = true;
+        done.notify_all();
+    }
+}
+
+void TaskGroup::wait(void) {
+    exception_ptr task_error;
+
+    join();
+
+    {
+        lock_guard<mutex> lock(done_lock);
+        swap(task_error, error);
+    }
+
+    if (task_error != nullptr) rethrow_exception(task_error);
+}
+
+void TaskGroup::join(void) {
+    unique_lock<mutex> lock(done_lock, defer_lock);
+
+    while (pending > 1 && scheduler.run_one()) {}
+
+    // Give up the waiter's count, and block unless that was the last
+    if (--pending > 0) {
+        lock.lock();
+        done.wait(lock, [this] {return finished;});
+        finished = false;
+    }
+
+    pending = 1;
+}
@@ -0,0 +1,101 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "spin_lock.h"
+
+// Rounds an idle worker spends looking for work before it sleeps
+#define SCHEDULER_SPIN_ROUNDS 64
+
+using namespace std;
+
+typedef function<void()> worker_task;
+
+class TaskGroup;
+
+struct scheduled_task {
+    worker_task task;
+    TaskGroup *group;
+};
+
+typedef struct scheduled_task scheduled_task_t;
+
+/*
+ * Work-stealing task scheduler. Every worker thread has a deque of its
+ * own: it pushes and pops tasks at the back, most recent first, while
+ * idle workers steal from the front of the others' deques. Tasks
+ * submitted from outside the scheduler are dealt out to the workers in
+ * turn. Each deque has its own spin lock, so submitting and running a
+ * task takes no system calls unless a worker has gone to sleep.
+ *
+ * Workers can be pinned to cores, one core each, in order.
+ */
+
+class Scheduler {
+    struct worker {
+        SpinLock lock;
+        deque<scheduled_task_t *> tasks;
+        thread handle;
+    };
+    vector<unique_ptr<struct worker>> workers;
+    atomic<long> num_queued;
+    atomic<int> num_sleeping, next_worker;
+    mutex sleep_lock;
+    condition_variable wake;
+    bool stop;
+    static thread_local Scheduler *current_scheduler;
+    static thread_local int current_worker;
+    void work(int, bool);
+    scheduled_task_t * pop(int);
+    scheduled_task_t * steal(int);
+    void execute(scheduled_task_t *);
+public:
+    Scheduler(int, bool pin = false);
+    ~Scheduler(void);
+    int size(void) const {return workers.size();}
+    void submit(worker_task, TaskGroup *group = nullptr);
+    bool run_one(void);
+};
+
+/*
+ * Fork/join: tasks run in a group can be waited for together. A thread
+ * that waits for a group helps run the scheduler's tasks until there
+ * are none left to take, and only then blocks. Once wait returns, the
+ * group can be reused.
+ *
+ * pending counts the unfinished tasks plus one held by the waiter, so
+ * that only the task that leaves the waiter the last one touches the
+ * group after finishing.
+ *
+ * A task that throws hands its exception to the group, and wait throws
+ * the first one once every task is done. A group that goes away without
+ * being waited for still waits, but drops the exception.
+ */
+
+class TaskGroup {
+    Scheduler& scheduler;
+    atomic<long> pending;
+    mutex done_lock;
+    condition_variable done;
+    bool finished;
+    exception_ptr error;
+    void join(void);
+public:
+    TaskGroup(Scheduler& scheduler) : scheduler(scheduler), pending(1), finished(false) {}
+    ~TaskGroup(void) {join();}
+    void run(worker_task);
+    void fail(exception_ptr);
+    void finish(void);
+    void wait(void);
+};
+
+#endif
@@ -0,0 +1,458 @@
+#include <arpa/inet.h>
+#include <cassert>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "lsm_tree.h"
+#include "protocol.h"
+#include "server.h"
+#include "sys.h"
+
+using namespace std;
+
+/*
+ * Listen on the Unix domain socket at the given path, replacing any
+ * left behind, or else on the given TCP port on the loopback interface
+ */
+
+Server::Server(LSMTree& tree, string socket_path, int port, int num_threads) :
+               tree(tree),
+               socket_path(socket_path),
+               num_threads(num_threads),
+               load_scheduler(SERVER_LOAD_THREAD_COUNT)
+{
+    struct sockaddr_un unix_address;
+    struct sockaddr_in tcp_address;
+    string name;
+    int result, enable;
+
+    if (!socket_path.empty()) {
+        name = "'" + socket_path + "'";
+
+        if (socket_path.size() >= sizeof(unix_address.sun_path)) {
+            die("Socket path " + name + " is too long.");
+        }
+
+        memset(&unix_address, 0, sizeof(unix_address));
+        unix_address.sun_family = AF_UNIX;
+        strcpy(unix_address.sun_path, socket_path.c_str());
+
+        unlink(socket_path.c_str());
+
+        listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        assert(listen_fd != -1);
+
+        result = ::bind(listen_fd, (struct sockaddr *)&unix_address, sizeof(unix_address));
+    } else {
+        name = "port " + to_string(port);
+
+        memset(&tcp_address, 0, sizeof(tcp_address));
+        tcp_address.sin_family = AF_INET;
+        tcp_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        tcp_address.sin_port = htons(port);
+
+        listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        assert(listen_fd != -1);
+
+        enable = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+        result = ::bind(listen_fd, (struct sockaddr *)&tcp_address, sizeof(tcp_address));
+    }
+
+    if (result != 0 || listen(listen_fd, SERVER_LISTEN_BACKLOG) != 0) {
+        die("Could not listen on " + name + ".");
+    }
+
+    stop_fd = eventfd(0, EFD_NONBLOCK);
+    assert(stop_fd != -1);
+}
+
+Server::~Server(void) {
+    close(stop_fd);
+    close(listen_fd);
+
+    if (!socket_path.empty()) unlink(socket_path.c_str());
+}
+
+void Server::run(void) {
+    sigset_t signals;
+    int signal, i;
+
+    for (i = 0; i < num_threads; i++) {
+        threads.emplace_back(&Server::event_loop, this);
+    }
+
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigwait(&signals, &signal);
+
+    stop();
+
+    for (auto& t : threads) t.join();
+    threads.clear();
+}
+
+/*
+ * Make every event loop return, closing its connections
+ */
+
+void Server::stop(void) {
+    uint64_t one;
+    ssize_t result;
+
+    one = 1;
+    result = write(stop_fd, &one, sizeof(one));
+    assert(result == sizeof(one));
+}
+
+/*
+ * Close a connection, unless a load it asked for is still running, in
+ * which case only its socket goes now, and the rest once the load is done
+ */
+
+static void close_connection(connection_t *conn, set<connection_t *>& connections) {
+    if (conn->fd != -1) {
+        close(conn->fd);
+        conn->fd = -1;
+    }
+
+    if (!conn->loading) {
+        connections.erase(conn);
+        delete conn;
+    }
+}
+
+void Server::event_loop(void) {
+    struct epoll_event events[SERVER_MAX_EVENTS], event;
+    struct pollfd load_poll;
+    set<connection_t *> connections;
+    load_completions_t loads;
+    connection_t *conn;
+    uint64_t count;
+    ssize_t reset;
+    int epoll_fd, num_events, result, i;
+    bool stopping, loads_done;
+
+    epoll_fd = epoll_create1(0);
+    assert(epoll_fd != -1);
+
+    // Only one of the threads waiting is woken for a new connection
+    event.events = EPOLLIN | EPOLLEXCLUSIVE;
+    event.data.ptr = &listen_fd;
+    result = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+    assert(result == 0);
+
+    event.events = EPOLLIN;
+    event.data.ptr = &stop_fd;
+    result = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd, &event);
+    assert(result == 0);
+
+    loads.fd = eventfd(0, EFD_NONBLOCK);
+    assert(loads.fd != -1);
+    loads.in_flight = 0;
+
+    event.events = EPOLLIN;
+    event.data.ptr = &loads;
+    result = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, loads.fd, &event);
+    assert(result == 0);
+
+    stopping = false;
+
+    while (!stopping) {
+        if ((num_events = epoll_wait(epoll_fd, events, SERVER_MAX_EVENTS, -1)) == -1) {
+            assert(errno == EINTR);
+            continue;
+        }
+
+        loads_done = false;
+
+        for (i = 0; i < num_events; i++) {
+            if (events[i].data.ptr == &stop_fd) {
+                stopping = true;
+            } else if (events[i].data.ptr == &listen_fd) {
+                accept_connections(epoll_fd, connections, loads);
+            } else if (events[i].data.ptr == &loads) {
+                loads_done = true;
+            } else {
+                conn = (connection_t *)events[i].data.ptr;
+
+                if (!service(conn) || (events[i].events & EPOLLERR)) {
+                    close_connection(conn, connections);
+                }
+            }
+        }
+
+        // Only once the other events are handled, since a connection
+        // finishing its load may be closed, while one of them is for it
+        if (loads_done) finish_loads(loads, connections);
+    }
+
+    // The loads still running report back to this loop, so it waits for
+    // them before letting go of their connections
+    load_poll.fd = loads.fd;
+    load_poll.events = POLLIN;
+
+    while (loads.in_flight > 0) {
+        poll(&load_poll, 1, -1);
+
+        // Reset the count, or poll would keep returning at once
+        reset = read(loads.fd, &count, sizeof(count));
+        assert(reset == sizeof(count) || errno == EAGAIN);
+
+        lock_guard<mutex> guard(loads.lock);
+        loads.in_flight -= loads.responses.size();
+        loads.responses.clear();
+    }
+
+    for (auto open_conn : connections) {
+        if (open_conn->fd != -1) close(open_conn->fd);
+        delete open_conn;
+    }
+
+    close(loads.fd);
+    close(epoll_fd);
+}
+
+/*
+ * Take every connection waiting on the listening socket, unless another
+ * thread takes it first
+ */
+
+void Server::accept_connections(int epoll_fd, set<connection_t *>& connections,
+                                load_completions_t& loads) {
+    struct epoll_event event;
+    connection_t *conn;
+    int fd, result, enable;
+
+    while ((fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK)) != -1) {
+        if (socket_path.empty()) {
+            // Responses are written whole, so there is nothing to gain
+            // from holding small ones back
+            enable = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        }
+
+        conn = new connection_t;
+        conn->fd = fd;
+        conn->output_sent = 0;
+        conn->loading = false;
+        conn->closed = false;
+        conn->loads = &loads;
+        connections.insert(conn);
+
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = conn;
+        result = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+        assert(result == 0);
+    }
+}
+
+/*
+ * Send as much of the pending output as the socket takes. Returns false
+ * if the connection failed.
+ */
+
+static bool send_output(connection_t *conn) {
+    string& output = conn->output.contents();
+    ssize_t result;
+
+    while (conn->output_sent < output.size()) {
+        result = send(conn->fd, output.data() + conn->output_sent,
+                      output.size() - conn->output_sent, MSG_NOSIGNAL);
+
+        if (result == -1) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+
+        conn->output_sent += result;
+    }
+
+    output.clear();
+    conn->output_sent = 0;
+
+    return true;
+}
+
+static size_t pending_output(connection_t *conn) {
+    return conn->output.contents().size() - conn->output_sent;
+}
+
+/*
+ * Run a load on a thread of its own, leaving its response for the
+ * connection's event loop to send
+ */
+
+void Server::hand_off_load(connection_t *conn, const protocol_header_t& header,
+                           const char *payload) {
+    load_completions_t *loads;
+    string file_path;
+
+    loads = conn->loads;
+    file_path.assign(payload, header.count);
+
+    conn->loading = true;
+    loads->in_flight++;
+
+    load_scheduler.submit([this, conn, loads, header, file_path] {
+        OutputBuffer out;
+        uint64_t one;
+        ssize_t result;
+
+        execute_request(tree, header, file_path.data(), out);
+
+        {
+            lock_guard<mutex> guard(loads->lock);
+            loads->responses.emplace_back(conn, move(out.contents()));
+        }
+
+        one = 1;
+        result = write(loads->fd, &one, sizeof(one));
+        assert(result == sizeof(one));
+    });
+}
+
+/*
+ * Send the responses of the loads that are done, and carry on with the
+ * requests their connections sent after them
+ */
+
+void Server::finish_loads(load_completions_t& loads, set<connection_t *>& connections) {
+    vector<pair<connection_t *, string>> responses;
+    connection_t *conn;
+    uint64_t count;
+    ssize_t result;
+
+    // Any load done after this wakes the loop again
+    result = read(loads.fd, &count, sizeof(count));
+    assert(result == sizeof(count) || errno == EAGAIN);
+
+    {
+        lock_guard<mutex> guard(loads.lock);
+        responses.swap(loads.responses);
+    }
+
+    for (auto& response : responses) {
+        conn = response.first;
+        conn->loading = false;
+        loads.in_flight--;
+
+        if (conn->fd == -1) {
+            // The connection failed while the load ran
+            close_connection(conn, connections);
+            continue;
+        }
+
+        conn->output.put(response.second.data(), response.second.size());
+
+        if (!service(conn)) close_connection(conn, connections);
+    }
+}
+
+/*
+ * Answer the whole requests read so far, in order. A range response is
+ * only written out while few enough responses are waiting to be sent,
+ * and is otherwise carried on with later, before any request after it.
+ * A load is handed off, and the requests after it wait until it is done.
+ * Returns false if the client sent something that is not a request.
+ */
+
+bool Server::answer_requests(connection_t *conn) {
+    protocol_header_t header;
+    const char *payload;
+    long payload_size;
+    size_t start;
+
+    start = 0;
+
+    while (true) {
+        while (conn->ranges != nullptr && pending_output(conn) < SERVER_MAX_PENDING_OUTPUT) {
+            if (!conn->ranges->write_frame(conn->output)) conn->ranges = nullptr;
+        }
+
+        if (conn->ranges != nullptr || conn->loading
+            || conn->input.size() - start < sizeof(header)) {
+            break;
+        }
+
+        memcpy(&header, conn->input.data() + start, sizeof(header));
+
+        if ((payload_size = request_payload_size(header)) < 0) {
+            return false;
+        } else if (conn->input.size() - start - sizeof(header) < (size_t)payload_size) {
+            break;
+        }
+
+        payload = conn->input.data() + start + sizeof(header);
+
+        if (header.op == OP_RANGE) {
+            conn->ranges.reset(new RangeResponse(tree, header, payload));
+        } else if (header.op == OP_LOAD) {
+            hand_off_load(conn, header, payload);
+        } else {
+            execute_request(tree, header, payload, conn->output);
+        }
+
+        start += sizeof(header) + payload_size;
+    }
+
+    conn->input.erase(0, start);
+
+    return true;
+}
+
+/*
+ * Read and answer requests on a connection until it has nothing more to
+ * read, has too many responses waiting to go out, or waits on a load.
+ * A client that closes its end still gets the responses to the requests
+ * it sent, for as long as the socket takes them. Returns false once the
+ * connection is to be closed: when every response to a client that has
+ * closed its end is sent, or the client sent something that is not a
+ * request, or the connection failed.
+ */
+
+bool Server::service(connection_t *conn) {
+    size_t length;
+    ssize_t result;
+
+    while (true) {
+        if (!answer_requests(conn) || !send_output(conn)) {
+            return false;
+        } else if (pending_output(conn) >= SERVER_MAX_PENDING_OUTPUT) {
+            // Carry on once the socket is writable again
+            return true;
+        } else if (conn->ranges != nullptr) {
+            // The socket took all there was, so write more of the range
+            continue;
+        } else if (conn->loading) {
+            // Carry on once the load is done
+            return true;
+        } else if (conn->closed) {
+            // Whatever the socket did not take goes once it is writable
+            return pending_output(conn) > 0;
+        }
+
+        length = conn->input.size();
+        conn->input.resize(length + IO_BUFFER_SIZE);
+        result = read(conn->fd, &conn->input[length], IO_BUFFER_SIZE);
+        conn->input.resize(length + max(result, (ssize_t)0));
+
+        if (result == -1 && errno == EINTR) {
+            continue;
+        } else if (result == -1) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+
+        conn->closed = (result == 0);
+    }
+}
@@ -0,0 +1,110 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "io.h"
+#include "protocol.h"
+#include "scheduler.h"
+
+#define DEFAULT_SERVER_THREAD_COUNT 4
+
+// Loads run on threads of their own, so as not to hold up the
+// connections of the event loop they came in on
+#define SERVER_LOAD_THREAD_COUNT 1
+
+// Events taken from epoll at a time
+#define SERVER_MAX_EVENTS 64
+#define SERVER_LISTEN_BACKLOG 128
+
+// A connection is not read from, nor are more frames of a range response
+// written, while this many bytes of responses to it are waiting to be
+// sent, so that a client that sends requests without reading the
+// responses cannot make the server buffer without bound
+#define SERVER_MAX_PENDING_OUTPUT (1 << 22)
+
+using namespace std;
+
+class LSMTree;
+struct load_completions;
+
+struct connection {
+    int fd;
+    string input;
+    OutputBuffer output;
+    size_t output_sent;
+    // The range response still being written, if any, which every
+    // request after it waits for
+    unique_ptr<RangeResponse> ranges;
+    // Set while a load the client asked for runs, which every request
+    // after it waits for too
+    bool loading;
+    // Set once the client has closed its end, after which what it sent
+    // is still answered, for as long as the responses can be sent
+    bool closed;
+    // Where the load is to report back to the connection's event loop
+    struct load_completions *loads;
+};
+
+typedef struct connection connection_t;
+
+/*
+ * The loads an event loop has handed off. The thread that runs each one
+ * leaves its response here, and wakes the loop through the event file
+ * descriptor to send it. A connection with a load running is kept until
+ * the load is done, even if it has failed meanwhile.
+ */
+
+struct load_completions {
+    int fd;
+    long in_flight;
+    mutex lock;
+    vector<pair<connection_t *, string>> responses;
+};
+
+typedef struct load_completions load_completions_t;
+
+/*
+ * Serves the binary protocol to any number of clients at once, over a
+ * Unix domain socket, or over TCP on the loopback interface.
+ *
+ * Each server thread runs an epoll event loop over connections of its
+ * own, and takes new ones from the listening socket as it can, so that
+ * connections spread over the threads. Sockets are non-blocking and
+ * edge-triggered: once a connection turns readable or writable, it is
+ * read until it runs dry and every whole request read is answered in
+ * order, so that a client may pipeline requests, sending more before
+ * the responses to the earlier ones arrive. The threads share the tree,
+ * which takes concurrent reads and writes. Loads, which take far longer
+ * than any other request, are handed off to threads of their own.
+ *
+ * run serves until SIGINT or SIGTERM arrives, and expects both to be
+ * blocked in every thread of the process, so that it can wait for them.
+ */
+
+class Server {
+    LSMTree& tree;
+    string socket_path;
+    int num_threads;
+    int listen_fd, stop_fd;
+    vector<thread> threads;
+    Scheduler load_scheduler;
+    void event_loop(void);
+    void accept_connections(int, set<connection_t *>&, load_completions_t&);
+    void hand_off_load(connection_t *, const protocol_header_t&, const char *);
+    void finish_loads(load_completions_t&, set<connection_t *>&);
+    bool answer_requests(connection_t *);
+    bool service(connection_t *);
+public:
+    Server(LSMTree&, string, int, int);
+    ~Server(void);
+    void run(void);
+    void stop(void);
+};
+
+#endif
@@ -0,0 +1,373 @@
+#include <cassert>
+#include <cstdlib>
+#include <functional>
+#include <thread>
+
+#include "skip_list.h"
+
+using namespace std;
+
+static inline skip_list_packed_t pack(VAL_t val, uint32_t seq) {
+    return ((skip_list_packed_t)seq << 32) | (uint32_t)val;
+}
+
+static inline VAL_t packed_val(skip_list_packed_t packed) {
+    return (VAL_t)(uint32_t)packed;
+}
+
+static inline uint32_t packed_seq(skip_list_packed_t packed) {
+    return packed >> 32;
+}
+
+static size_t node_size(int height) {
+    size_t size;
+
+    size = sizeof(skip_list_node_t) + (height - 1) * sizeof(atomic<skip_list_node_t *>);
+
+    // Keep nodes pointer-aligned
+    return (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+}
+
+SkipList::SkipList(long max_size) : Buffer(max_size) {
+    // The head, and max_size nodes as tall as nodes come
+    arena_size = (max_size + 1) * node_size(SKIP_LIST_MAX_HEIGHT);
+
+    arena = (char *)malloc(arena_size);
+    assert(arena != nullptr);
+    assert(arena_size / sizeof(void *) <= UINT32_MAX);
+
+    sorted_entries.reserve(max_size);
+
+    empty();
+}
+
+SkipList::~SkipList(void) {
+    free(arena);
+}
+
+int SkipList::random_height(void) {
+    static thread_local uint32_t random_state =
+        hash<thread::id>()(this_thread::get_id()) | 1;
+    int height;
+
+    height = 1;
+
+    while (height < SKIP_LIST_MAX_HEIGHT) {
+        // xorshift32
+        random_state ^= random_state << 13;
+        random_state ^= random_state >> 17;
+        random_state ^= random_state << 5;
+
+        if (random_state % SKIP_LIST_BRANCHING != 0) break;
+        height++;
+    }
+
+    return height;
+}
+
+void * SkipList::allocate(size_t size) {
+    size_t offset;
+
+    offset = arena_used.fetch_add(size);
+
+    // Space claimed past the end of the arena is simply wasted; the
+    // buffer is full at that point anyway.
+    if (offset + size > arena_size) {
+        return nullptr;
+    }
+
+    return arena + offset;
+}
+
+skip_list_node_t * SkipList::allocate_node(int height) {
+    return (skip_list_node_t *)allocate(node_size(height));
+}
+
+/*
+ * Translate a sequence number to one relative to the buffer's base,
+ * clamped to the range the buffer can hold
+ */
+
+uint32_t SkipList::relative_seq(SEQ_t seq) const {
+    if (seq <= base_seq) {
+        return 0;
+    } else if (seq - base_seq >= UINT32_MAX) {
+        return UINT32_MAX;
+    } else {
+        return seq - base_seq;
+    }
+}
+
+/*
+ * Find the most recent value of a node written at or before the given
+ * relative sequence number. Older versions are not necessarily in
+ * order, since concurrent writers may push them in either order, so
+ * the whole list is searched; it is only ever long while snapshots are
+ * pinning a key that is being overwritten.
+ */
+
+bool SkipList::visible(const skip_list_node_t *node, uint32_t seq, VAL_t& val) const {
+    skip_list_packed_t latest;
+    const skip_list_version_t *version, *best;
+    uint32_t older;
+
+    latest = node->latest.load(memory_order_acquire);
+
+    if (packed_seq(latest) <= seq) {
+        val = packed_val(latest);
+        return true;
+    }
+
+    best = nullptr;
+
+    for (older = node->older.load(memory_order_acquire); older != 0; older = version->older) {
+        version = version_at(older);
+
+        if (packed_seq(version->packed) <= seq
+            && (best == nullptr || packed_seq(version->packed) > packed_seq(best->packed))) {
+            best = version;
+        }
+    }
+
+    if (best == nullptr) {
+        return false;
+    }
+
+    val = packed_val(best->packed);
+    return true;
+}
+
+const skip_list_version_t * SkipList::version_at(uint32_t offset) const {
+    return (const skip_list_version_t *)(arena + offset * sizeof(void *));
+}
+
+/*
+ * Write a new value for an existing key, unless a write with a greater
+ * sequence number got there first, so that the buffer ends up with the
+ * last write to each key however concurrent writes interleave. The
+ * latest value can be overwritten only if no snapshot sees it, which is
+ * when it is more recent than every pinned sequence number. Otherwise
+ * it is pushed onto the older versions before being replaced, so a
+ * reader that sees the replacement also finds the value it replaced.
+ */
+
+bool SkipList::update(skip_list_node_t *node, skip_list_packed_t packed, uint32_t pinned) {
+    skip_list_packed_t latest;
+
+    latest = node->latest.load(memory_order_acquire);
+
+    while (packed_seq(latest) < packed_seq(packed)) {
+        if (packed_seq(latest) <= pinned && !preserve(node, latest)) {
+            return false;
+        }
+
+        if (node->latest.compare_exchange_weak(latest, packed, memory_order_release,
+                                               memory_order_acquire)) {
+            break;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Push a copy of a value onto a node's older versions. Returns false if
+ * the arena is full.
+ */
+
+bool SkipList::preserve(skip_list_node_t *node, skip_list_packed_t packed) {
+    skip_list_version_t *version;
+    uint32_t offset, older;
+
+    if ((version = (skip_list_version_t *)allocate(sizeof(skip_list_version_t))) == nullptr) {
+        return false;
+    }
+
+    version->packed = packed;
+    offset = ((char *)version - arena) / sizeof(void *);
+    older = node->older.load(memory_order_relaxed);
+
+    do {
+        version->older = older;
+    } while (!node->older.compare_exchange_weak(older, offset, memory_order_release));
+
+    return true;
+}
+
+/*
+ * Return the first node whose key is at least the search key, or
+ * nullptr if there is none.
+ */
+
+skip_list_node_t * SkipList::find_greater_or_equal(KEY_t key) const {
+    skip_list_node_t *node, *next;
+    int level;
+
+    node = head;
+    level = SKIP_LIST_MAX_HEIGHT - 1;
+
+    while (true) {
+        next = node->next[level].load(memory_order_acquire);
+
+        if (next != nullptr && next->key < key) {
+            node = next;
+        } else if (level == 0) {
+            return next;
+        } else {
+            level--;
+        }
+    }
+}
+
+/*
+ * Find the nodes between which a node with the given key belongs at
+ * every height from top_level down to 0, starting the search from
+ * start (which must precede the key at top_level).
+ */
+
+void SkipList::find_splice(KEY_t key, skip_list_node_t *start, int top_level,
+                           skip_list_node_t **prev, skip_list_node_t **next) const {
+    skip_list_node_t *node, *candidate;
+    int level;
+
+    node = start;
+
+    for (level = top_level; level >= 0; level--) {
+        while ((candidate = node->next[level].load(memory_order_acquire)) != nullptr
+               && candidate->key < key) {
+            node = candidate;
+        }
+
+        prev[level] = node;
+        next[level] = candidate;
+    }
+}
+
+bool SkipList::get(KEY_t key, VAL_t& val, SEQ_t seq) const {
+    skip_list_node_t *node;
+
+    node = find_greater_or_equal(key);
+
+    return node != nullptr && node->key == key && visible(node, relative_seq(seq), val);
+}
+
+long SkipList::scan(KEY_t start, KEY_t end, entry_t *output, long max_entries, SEQ_t seq) const {
+    skip_list_node_t *node;
+    uint32_t relative;
+    long num_entries;
+
+    node = find_greater_or_equal(start);
+    relative = relative_seq(seq);
+    num_entries = 0;
+
+    while (num_entries < max_entries && node != nullptr && node->key <= end) {
+        if (visible(node, relative, output[num_entries].val)) {
+            output[num_entries].key = node->key;
+            num_entries++;
+        }
+
+        node = node->next[0].load(memory_order_acquire);
+    }
+
+    return num_entries;
+}
+
+bool SkipList::put(KEY_t key, VAL_t val, SEQ_t seq, SEQ_t pinned) {
+    skip_list_node_t *prev[SKIP_LIST_MAX_HEIGHT], *next[SKIP_LIST_MAX_HEIGHT];
+    skip_list_node_t *node;
+    skip_list_packed_t packed;
+    int height, i;
+
+    // Sequence numbers past what a node can hold fill the buffer as
+    // surely as new keys do
+    if (seq - base_seq >= UINT32_MAX) {
+        return false;
+    }
+
+    packed = pack(val, relative_seq(seq));
+
+    find_splice(key, head, SKIP_LIST_MAX_HEIGHT - 1, prev, next);
+
+    // Update the entry if it already exists
+    if (next[0] != nullptr && next[0]->key == key) {
+        return update(next[0], packed, relative_seq(pinned));
+    }
+
+    // Reserve a slot before allocating, so that concurrent
+    // writers cannot overfill the buffer
+    if (num_entries.fetch_add(1) >= max_size) {
+        num_entries--;
+        return false;
+    }
+
+    height = random_height();
+
+    if ((node = allocate_node(height)) == nullptr) {
+        num_entries--;
+        return false;
+    }
+
+    node->key = key;
+    node->latest.store(packed, memory_order_relaxed);
+    node->older.store(0, memory_order_relaxed);
+
+    /*
+     * Link the node in from the bottom up. Once it is linked into
+     * level 0 it is visible to readers; the upper levels only make it
+     * faster to find. If another writer changed a splice under us,
+     * recompute that level and retry.
+     */
+
+    for (i = 0; i < height; i++) {
+        while (true) {
+            node->next[i].store(next[i], memory_order_relaxed);
+
+            if (prev[i]->next[i].compare_exchange_strong(next[i], node)) {
+                break;
+            }
+
+            find_splice(key, prev[i], i, prev, next);
+
+            // Another writer inserted the same key first, so update
+            // theirs and abandon our node.
+            if (i == 0 && next[0] != nullptr && next[0]->key == key) {
+                num_entries--;
+                return update(next[0], packed, relative_seq(pinned));
+            }
+        }
+    }
+
+    return true;
+}
+
+const entry_t * SkipList::sorted(void) {
+    skip_list_node_t *node;
+    entry_t entry;
+
+    sorted_entries.clear();
+
+    node = head->next[0].load(memory_order_acquire);
+
+    while (node != nullptr) {
+        entry.key = node->key;
+        entry.val = packed_val(node->latest.load(memory_order_relaxed));
+        sorted_entries.push_back(entry);
+
+        node = node->next[0].load(memory_order_acquire);
+    }
+
+    return sorted_entries.data();
+}
+
+void SkipList::empty(void) {
+    int i;
+
+    arena_used = 0;
+    num_entries = 0;
+
+    head = allocate_node(SKIP_LIST_MAX_HEIGHT);
+
+    for (i = 0; i < SKIP_LIST_MAX_HEIGHT; i++) {
+        head->next[i].store(nullptr, memory_order_relaxed);
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef SKIP_LIST_H
+#define SKIP_LIST_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "buffer.h"
+#include "types.h"
+
+#define SKIP_LIST_MAX_HEIGHT 12
+#define SKIP_LIST_BRANCHING 4
+
+using namespace std;
+
+/*
+ * Skip list buffer whose nodes are bump-allocated out of a single
+ * arena sized when the buffer is created. Inserting a new key never
+ * allocates, and updating an existing key overwrites its value in place
+ * unless a snapshot pins it. Pinned values move to a list of older
+ * versions hanging off the node, also allocated from the arena. A
+ * buffer whose sequence numbers outgrow 32 bits reports itself full.
+ * Emptying the buffer just rewinds the arena.
+ *
+ * The arena has room for max_size nodes of the greatest height, so that
+ * however tall its nodes come out, the buffer holds max_size entries.
+ * Nodes are of the expected height far more often, and the arena is
+ * only ever touched as far as it is used, so the room left over costs
+ * address space rather than memory; it is what older versions, and the
+ * nodes of inserts that lose a race for the same key, take up. Only a
+ * buffer holding enough of those fills up before max_size entries.
+ *
+ * Any number of threads may call put, get and range concurrently: nodes
+ * are claimed from the arena with an atomic increment and spliced in
+ * with compare-and-swap, one level at a time, and versions are pushed
+ * the same way. sorted and empty must only be called once all writers
+ * have left the buffer.
+ */
+
+/*
+ * A value and the sequence number it was written at, relative to the
+ * buffer's base_seq, packed into one word so that both change at once
+ */
+
+typedef uint64_t skip_list_packed_t;
+
+// Older versions are linked by their offset into the arena, in words,
+// which keeps nodes as small as they were before versions existed. The
+// head node is at offset 0, so 0 ends the list.
+struct skip_list_version {
+    skip_list_packed_t packed;
+    uint32_t older;
+};
+
+typedef struct skip_list_version skip_list_version_t;
+
+struct skip_list_node {
+    KEY_t key;
+    atomic<uint32_t> older;
+    atomic<skip_list_packed_t> latest;
+    atomic<struct skip_list_node *> next[1];
+};
+
+typedef struct skip_list_node skip_list_node_t;
+
+class SkipList : public Buffer {
+    char *arena;
+    size_t arena_size;
+    atomic<size_t> arena_used;
+    skip_list_node_t *head;
+    atomic<long> num_entries;
+    vector<entry_t> sorted_entries;
+    int random_height(void);
+    void * allocate(size_t);
+    skip_list_node_t * allocate_node(int);
+    const skip_list_version_t * version_at(uint32_t) const;
+    bool update(skip_list_node_t *, skip_list_packed_t, uint32_t);
+    bool preserve(skip_list_node_t *, skip_list_packed_t);
+    uint32_t relative_seq(SEQ_t) const;
+    bool visible(const skip_list_node_t *, uint32_t, VAL_t&) const;
+    skip_list_node_t * find_greater_or_equal(KEY_t) const;
+    void find_splice(KEY_t, skip_list_node_t *, int, skip_list_node_t **, skip_list_node_t **) const;
+public:
+    SkipList(long);
+    ~SkipList(void);
+    bool get(KEY_t, VAL_t&, SEQ_t) const;
+    long scan(KEY_t, KEY_t, entry_t *, long, SEQ_t) const;
+    bool put(KEY_t, VAL_t, SEQ_t, SEQ_t);
+    long size(void) const {return num_entries;}
+    const entry_t * sorted(void);
+    void empty(void);
+};
+
+#endif
@@ -0,0 +1,20 @@
+#include "status.h"
+
+const char *status_string(lsm_status status) {
+    switch (status) {
+    case LSM_OK:
+        return "OK";
+    case LSM_INVALID_ARGUMENT:
+        return "Invalid argument";
+    case LSM_NOT_FOUND:
+        return "Not found";
+    case LSM_IO_ERROR:
+        return "I/O error";
+    case LSM_CORRUPTION:
+        return "Corruption";
+    case LSM_NO_SPACE:
+        return "No space";
+    }
+
+    return "Unknown";
+}
@@ -0,0 +1,42 @@
+#ifndef STATUS_H
+#define STATUS_H
+
+#include <stdexcept>
+#include <string>
+
+/*
+ * What went wrong, for errors that a caller of the tree can do
+ * something about, rather than bugs
+ */
+
+enum lsm_status {
+    LSM_OK,
+    // A key, value or option out of range, or a data directory written
+    // by a tree of a different shape
+    LSM_INVALID_ARGUMENT,
+    // A file to load that does not exist
+    LSM_NOT_FOUND,
+    // A file or directory of the tree's own that could not be opened,
+    // written or synced. Once a flush or merge has failed this way, the
+    // tree takes no more writes.
+    LSM_IO_ERROR,
+    LSM_CORRUPTION,
+    // The last level has filled up, so the tree takes no more writes
+    LSM_NO_SPACE
+};
+
+const char *status_string(lsm_status);
+
+/*
+ * Thrown by the tree on any of the errors above, and turned back into
+ * a status where the tree meets its callers
+ */
+
+class TreeError : public std::runtime_error {
+public:
+    const lsm_status status;
+    TreeError(lsm_status status, const std::string& message) :
+              std::runtime_error(message), status(status) {}
+};
+
+#endif
@@ -1,5 +1,8 @@
+#include <fcntl.h>
 #include <iostream>
+#include <unistd.h>
 
+#include "status.h"
 #include "sys.h"
 
 using namespace std;
@@ -9,3 +12,23 @@ void die(string error_msg) {
     cerr << "Exiting..." << endl;
     exit(EXIT_FAILURE);
 }
+
+/*
+ * Make the entries of a directory durable: files created, renamed or
+ * removed in it
+ */
+
+void sync_directory(string path) {
+    int fd, result;
+
+    if ((fd = open(path.c_str(), O_RDONLY | O_DIRECTORY)) == -1) {
+        throw TreeError(LSM_IO_ERROR, "Could not open directory '" + path + "'.");
+    }
+
+    result = fsync(fd);
+    close(fd);
+
+    if (result != 0) {
+        throw TreeError(LSM_IO_ERROR, "Could not sync directory '" + path + "'.");
+    }
+}
@@ -1,3 +1,4 @@
 #include <string>
 
 void die(std::string);
+void sync_directory(std::string);
@@ -1,9 +1,14 @@
 #ifndef TYPES_H
 #define TYPES_H
 
+#include <cstdint>
+
 typedef int32_t KEY_t;
 typedef int32_t VAL_t;
 
+// Sequence numbers order writes; every write takes the next one
+typedef uint64_t SEQ_t;
+
 #define KEY_MAX 2147483647
 #define KEY_MIN -2147483648
 
@@ -11,6 +16,8 @@ typedef int32_t VAL_t;
 #define VAL_MIN -2147483647
 #define VAL_TOMBSTONE -2147483648
 
+#define SEQ_MAX UINT64_MAX
+
 struct entry {
     KEY_t key;
     VAL_t val;
@@ -0,0 +1,48 @@
+#ifndef VERSION_H
+#define VERSION_H
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "buffer.h"
+#include "types.h"
+
+using namespace std;
+
+class Run;
+
+/*
+ * An immutable view of what the tree holds: its buffers, and its runs
+ * in the order they are searched, most recent first. The tree publishes
+ * a new version whenever a buffer is frozen or flushed, or a merge is
+ * installed. Readers take a reference to the current version and search
+ * it without holding any lock, and the buffers and runs it refers to
+ * live on until the last version referring to them is gone.
+ */
+
+struct version {
+    shared_ptr<Buffer> buffer, immutable_buffer;
+    vector<shared_ptr<Run>> runs;
+};
+
+typedef struct version version_t;
+
+/*
+ * A snapshot pins a version, along with the sequence number of the last
+ * write made before it was taken. Reads through a snapshot see exactly
+ * the writes up to that sequence number, however the tree has changed
+ * since. Snapshots must be released before the tree is destroyed.
+ */
+
+class Snapshot {
+    function<void(void)> release;
+public:
+    const SEQ_t seq;
+    const shared_ptr<const version_t> version;
+    Snapshot(SEQ_t seq, shared_ptr<const version_t> version, function<void(void)> release) :
+             release(release), seq(seq), version(version) {}
+    ~Snapshot(void) {release();}
+};
+
+#endif
@@ -0,0 +1,319 @@
+#include <chrono>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "status.h"
+#include "wal.h"
+
+using namespace std;
+
+/*
+ * FNV-1a over the entries of a batch, a word at a time, seeded with
+ * their number. This only has to catch batches torn by a crash.
+ */
+
+static uint32_t checksum(const entry_t *entries, uint32_t num_entries) {
+    const uint32_t *words;
+    uint32_t hash;
+    size_t i;
+
+    words = (const uint32_t *)entries;
+    hash = 2166136261u ^ num_entries;
+
+    for (i = 0; i < num_entries * sizeof(entry_t) / sizeof(uint32_t); i++) {
+        hash ^= words[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static bool read_fully(int fd, void *data, size_t length, off_t offset) {
+    ssize_t result;
+    size_t done;
+
+    done = 0;
+
+    while (done < length) {
+        if ((result = pread(fd, (char *)data + done, length - done, offset + done)) <= 0) {
+            return false;
+        }
+
+        done += result;
+    }
+
+    return true;
+}
+
+static void write_fully(int fd, const void *data, size_t length, off_t offset) {
+    ssize_t result;
+    size_t done;
+
+    done = 0;
+
+    while (done < length) {
+        result = pwrite(fd, (const char *)data + done, length - done, offset + done);
+
+        if (result <= 0) {
+            throw TreeError(LSM_IO_ERROR, "Could not write log.");
+        }
+
+        done += result;
+    }
+}
+
+static int open_log(string path) {
+    int fd;
+
+    if ((fd = open(path.c_str(), O_RDWR | O_CREAT, 0644)) == -1) {
+        throw TreeError(LSM_IO_ERROR, "Could not open log '" + path + "'.");
+    }
+
+    return fd;
+}
+
+WriteAheadLog::WriteAheadLog(string path, wal_durability durability) :
+                             durability(durability),
+                             appended_seq(0),
+                             writing(false),
+                             failed(false),
+                             written_seq(0),
+                             synced_seq(0),
+                             stop(false)
+{
+    fd = open_log(path);
+    log_size = lseek(fd, 0, SEEK_END);
+
+    pending.reserve(WAL_BATCH_MAX_ENTRIES);
+    batch.reserve(WAL_BATCH_MAX_ENTRIES);
+
+    if (durability == WAL_PERIODIC) {
+        syncer = thread(&WriteAheadLog::sync_periodically, this);
+    }
+}
+
+WriteAheadLog::~WriteAheadLog(void) {
+    unique_lock<mutex> lock(write_lock);
+
+    stop = true;
+    written.notify_all();
+    lock.unlock();
+
+    if (syncer.joinable()) syncer.join();
+
+    // Whatever the durability, a clean shutdown leaves nothing unsynced,
+    // unless the log has already failed, and then there is no one left
+    // to tell
+    try {
+        write(appended_seq, true);
+    } catch (const TreeError&) {}
+
+    close(fd);
+}
+
+/*
+ * Apply every whole batch in a log, in order, and cut off whatever a
+ * crash left of the batch after them
+ */
+
+void WriteAheadLog::replay(string path, function<void(const entry_t&)> apply) {
+    wal_batch_header_t header;
+    vector<entry_t> entries;
+    off_t file_size, log_size;
+    int fd, result;
+
+    fd = open_log(path);
+    file_size = lseek(fd, 0, SEEK_END);
+    log_size = 0;
+
+    while (read_fully(fd, &header, sizeof(header), log_size)) {
+        if (header.num_entries == 0
+            || header.num_entries > (file_size - log_size - sizeof(header)) / sizeof(entry_t)) {
+            break;
+        }
+
+        entries.resize(header.num_entries);
+
+        if (!read_fully(fd, entries.data(), header.num_entries * sizeof(entry_t),
+                        log_size + sizeof(header))
+            || checksum(entries.data(), header.num_entries) != header.checksum) {
+            break;
+        }
+
+        for (const auto& entry : entries) {
+            apply(entry);
+        }
+
+        log_size += sizeof(header) + header.num_entries * sizeof(entry_t);
+    }
+
+    result = ftruncate(fd, log_size);
+    close(fd);
+
+    if (result != 0) {
+        throw TreeError(LSM_IO_ERROR, "Could not truncate log '" + path + "'.");
+    }
+}
+
+/*
+ * Switch to appending to a new, empty log, once everything appended so
+ * far is synced to the current one. No writer may append meanwhile.
+ */
+
+void WriteAheadLog::rotate(string path) {
+    unique_lock<mutex> lock(write_lock, defer_lock);
+    int next_fd;
+    SEQ_t seq;
+
+    next_fd = open_log(path);
+
+    append_lock.lock();
+    seq = appended_seq;
+    append_lock.unlock();
+
+    try {
+        if (ftruncate(next_fd, 0) != 0) {
+            throw TreeError(LSM_IO_ERROR, "Could not truncate log '" + path + "'.");
+        }
+
+        write(seq, true);
+    } catch (const TreeError&) {
+        close(next_fd);
+        throw;
+    }
+
+    // Wait out the periodic sync, if it is writing
+    lock.lock();
+    written.wait(lock, [this] {return !writing;});
+
+    close(fd);
+    fd = next_fd;
+    log_size = 0;
+}
+
+/*
+ * Append a write to the log, numbering it with the next sequence number
+ * while holding the append lock, so that the log is in sequence order.
+ * Returns the sequence number taken.
+ */
+
+SEQ_t WriteAheadLog::append(KEY_t key, VAL_t val, atomic<SEQ_t>& last_seq) {
+    entry_t entry;
+    SEQ_t seq;
+    bool full;
+
+    entry.key = key;
+    entry.val = val;
+
+    append_lock.lock();
+    seq = ++last_seq;
+    pending.push_back(entry);
+    appended_seq = seq;
+    full = (pending.size() >= WAL_BATCH_MAX_ENTRIES);
+    append_lock.unlock();
+
+    if (full) write(seq, false);
+
+    return seq;
+}
+
+/*
+ * Return once the write with the given sequence number is as durable as
+ * the log promises. Whatever the durability, it is written out to the
+ * file first, where it survives the process crashing.
+ */
+
+void WriteAheadLog::commit(SEQ_t seq) {
+    write(seq, durability == WAL_PER_BATCH);
+}
+
+/*
+ * Wait until every entry up to the given sequence number is written
+ * out, and synced if asked for, writing them out if no other writer is
+ */
+
+void WriteAheadLog::write(SEQ_t seq, bool sync) {
+    unique_lock<mutex> lock(write_lock);
+    SEQ_t batch_seq;
+    bool done;
+
+    while ((sync ? synced_seq : written_seq) < seq) {
+        if (failed) {
+            throw TreeError(LSM_IO_ERROR, "Could not write log.");
+        } else if (writing) {
+            written.wait(lock);
+            continue;
+        }
+
+        writing = true;
+        lock.unlock();
+
+        // Take everything appended so far
+        append_lock.lock();
+        swap(batch, pending);
+        batch_seq = appended_seq;
+        append_lock.unlock();
+
+        try {
+            write_batch();
+            done = !sync || fdatasync(fd) == 0;
+        } catch (const TreeError&) {
+            done = false;
+        }
+
+        lock.lock();
+        writing = false;
+
+        if (!done) {
+            failed = true;
+            written.notify_all();
+            continue;
+        }
+
+        written_seq = batch_seq;
+        if (sync) synced_seq = batch_seq;
+        written.notify_all();
+    }
+}
+
+/*
+ * Write the batch out after the end of the log, and empty it
+ */
+
+void WriteAheadLog::write_batch(void) {
+    wal_batch_header_t header;
+
+    if (batch.empty()) return;
+
+    header.num_entries = batch.size();
+    header.checksum = checksum(batch.data(), header.num_entries);
+
+    write_fully(fd, &header, sizeof(header), log_size);
+    write_fully(fd, batch.data(), batch.size() * sizeof(entry_t), log_size + sizeof(header));
+
+    log_size += sizeof(header) + batch.size() * sizeof(entry_t);
+    batch.clear();
+}
+
+void WriteAheadLog::sync_periodically(void) {
+    unique_lock<mutex> lock(write_lock);
+    SEQ_t seq;
+
+    while (!written.wait_for(lock, chrono::milliseconds(WAL_SYNC_INTERVAL_MS), [this] {return stop;})) {
+        lock.unlock();
+
+        append_lock.lock();
+        seq = appended_seq;
+        append_lock.unlock();
+
+        try {
+            write(seq, true);
+        } catch (const TreeError&) {
+            // Writers find out from their own commits
+            return;
+        }
+
+        lock.lock();
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "options.h"
+#include "spin_lock.h"
+#include "types.h"
+
+// Writers write the log out once this many entries are waiting to be
+// written, even part way through a batch, as well as when they commit
+#define WAL_BATCH_MAX_ENTRIES (1 << 13)
+
+// How often the log is synced with periodic durability
+#define WAL_SYNC_INTERVAL_MS 10
+
+using namespace std;
+
+struct wal_batch_header {
+    uint32_t num_entries;
+    uint32_t checksum;
+};
+
+typedef struct wal_batch_header wal_batch_header_t;
+
+/*
+ * Write-ahead log of the writes to the tree, as entries in the order of
+ * their sequence numbers. Appending an entry only copies it into memory,
+ * under a spin lock. Entries are written out in batches, each with a
+ * header that holds its length and a checksum, so that replay can tell
+ * where a batch torn by a crash begins and stop there.
+ *
+ * A log is replayed, entry by entry, before it is opened, and is then
+ * appended to from the end of its last whole batch. It can be rotated
+ * to a new file, so that a log that has been made redundant can be
+ * removed as a whole.
+ *
+ * Group commit: one writer at a time writes out every entry appended so
+ * far, and syncs the log if asked to, while the rest wait for it; a
+ * writer whose entry was covered by that batch is done without touching
+ * the file.
+ *
+ * Once writing to or syncing the log fails, what was appended is no
+ * longer known to be in it, so every write and commit after fails too.
+ */
+
+class WriteAheadLog {
+    int fd;
+    off_t log_size;
+    wal_durability durability;
+    SpinLock append_lock;
+    vector<entry_t> pending;
+    SEQ_t appended_seq;
+    mutex write_lock;
+    condition_variable written;
+    bool writing, failed;
+    vector<entry_t> batch;
+    SEQ_t written_seq, synced_seq;
+    thread syncer;
+    bool stop;
+    void write(SEQ_t, bool);
+    void write_batch(void);
+    void sync_periodically(void);
+public:
+    WriteAheadLog(string, wal_durability);
+    ~WriteAheadLog(void);
+    static void replay(string, function<void(const entry_t&)>);
+    void rotate(string);
+    SEQ_t append(KEY_t, VAL_t, atomic<SEQ_t>&);
+    void commit(SEQ_t);
+};
+
+#endif
@@ -0,0 +1,139 @@
+// Built as code embedding the tree would be: as C++17, with the standard
+// optional and the std namespace in view, and with every warning an
+// error, against the library rather than the tree's own sources. Checks
+// that the public header leaves the embedder's namespace alone, and that
+// the library answers a small workload as a map would, and finds what it
+// wrote to a data directory whole once the directory is reopened.
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <optional>
+#include <vector>
+
+#include "lsm.h"
+
+using namespace std;
+
+#define NUM_KEYS 5000
+#define NUM_ROUNDS 200
+
+static void check(bool condition, const char *what) {
+    if (!condition) {
+        fprintf(stderr, "embed: %s\n", what);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Check every key, one at a time and as a batch, against the model
+static void check_gets(Database& db, map<KEY_t, VAL_t>& model) {
+    vector<KEY_t> keys(NUM_KEYS);
+    vector<std::experimental::optional<VAL_t>> vals(NUM_KEYS);
+    KEY_t key;
+
+    for (key = 0; key < NUM_KEYS; key++) {
+        auto val = db.get(key);
+
+        check(bool(val) == (model.count(key) > 0), "get found");
+        check(!val || *val == model[key], "get value");
+        keys[key] = key;
+    }
+
+    db.get(keys.data(), keys.size(), vals.data());
+
+    for (key = 0; key < NUM_KEYS; key++) {
+        check(bool(vals[key]) == (model.count(key) > 0), "batch get found");
+        check(!vals[key] || *vals[key] == model[key], "batch get value");
+    }
+}
+
+int main(void) {
+    lsm_options_t options, bad_options;
+    unique_ptr<Database> db;
+    map<KEY_t, VAL_t> model;
+    map<KEY_t, VAL_t>::iterator expected;
+    vector<entry_t> batch(100);
+    vector<KEY_t> deletes(20);
+    shared_ptr<Snapshot> snapshot;
+    optional<int> unrelated;
+    char data_dir[] = "/tmp/lsm-embed-XXXXXX";
+    string error;
+    int round;
+
+    options.buffer_max_entries = 512;
+    options.depth = 4;
+    options.fanout = 4;
+
+    bad_options = options;
+    bad_options.page_sizes = {100};
+    check(Database::open(bad_options, db, &error) == LSM_INVALID_ARGUMENT && !error.empty(),
+          "open with a bad page size");
+
+    check(mkdtemp(data_dir) != nullptr, "data directory");
+    options.data_dir = string(data_dir) + "/data";
+
+    check(Database::open(options, db) == LSM_OK, "open");
+
+    srand(1);
+
+    for (round = 0; round < NUM_ROUNDS; round++) {
+        for (auto& entry : batch) {
+            entry.key = rand() % NUM_KEYS;
+            entry.val = rand() % 100000;
+            model[entry.key] = entry.val;
+        }
+
+        check(db->put(batch.data(), batch.size()) == LSM_OK, "put");
+
+        for (auto& deleted : deletes) {
+            deleted = rand() % NUM_KEYS;
+            model.erase(deleted);
+        }
+
+        check(db->del(deletes.data(), deletes.size()) == LSM_OK, "delete");
+    }
+
+    check_gets(*db, model);
+
+    snapshot = db->snapshot();
+    check(db->put(100, 42) == LSM_OK, "put after snapshot");
+
+    expected = model.lower_bound(100);
+
+    for (auto it = db->range(100, 300, snapshot.get()); it.valid(); it.next(), expected++) {
+        check(it.entry().key == expected->first && it.entry().val == expected->second,
+              "range at snapshot");
+    }
+
+    check(expected == model.lower_bound(300), "range end");
+    check(!db->range(300, 100).valid(), "empty range");
+    check(*db->get(100) == 42, "get after snapshot");
+    model[100] = 42;
+
+    check(db->put(5, VAL_TOMBSTONE) == LSM_INVALID_ARGUMENT, "reserved value");
+    check(db->load("/nonexistent", &error) == LSM_NOT_FOUND && !error.empty(), "load");
+
+    // What was written, with the buffer's last entries, is found whole
+    // once the data directory is reopened
+    snapshot = nullptr;
+    db = nullptr;
+    check(Database::open(options, db) == LSM_OK, "reopen");
+    check_gets(*db, model);
+    db = nullptr;
+
+    // A tree of another shape cannot take over the directory
+    bad_options = options;
+    bad_options.fanout = 8;
+    check(Database::open(bad_options, db, &error) == LSM_INVALID_ARGUMENT && !error.empty(),
+          "reopen with another fanout");
+
+    check(system(("rm -r " + string(data_dir)).c_str()) == 0, "remove data directory");
+
+    // The standard optional stays usable alongside the library's
+    unrelated = 1;
+    check(unrelated.has_value(), "standard optional");
+
+    puts("OK");
+
+    return 0;
+}
@@ -0,0 +1,103 @@
+// Built against the library as test/embed.cpp is. Checks the paths the
+// tree only takes at scale, by lowering the thresholds for them: merges
+// split into key ranges that are merged in parallel, under each merge
+// policy, and gets that search the runs on the query threads at once.
+// With no block cache, every run a get searches reads a page outside
+// it, so every get that reaches the runs fans out.
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+#include "lsm.h"
+
+using namespace std;
+
+#define NUM_KEYS 20000
+#define NUM_ROUNDS 200
+
+static void check(bool condition, const char *what) {
+    if (!condition) {
+        fprintf(stderr, "parallel: %s\n", what);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Write a round of puts and deletes to the tree and the model alike
+static void write_round(Database& db, map<KEY_t, VAL_t>& model) {
+    vector<entry_t> batch(200);
+    vector<KEY_t> deletes(40);
+
+    for (auto& entry : batch) {
+        entry.key = rand() % NUM_KEYS;
+        entry.val = rand() % 100000;
+        model[entry.key] = entry.val;
+    }
+
+    check(db.put(batch.data(), batch.size()) == LSM_OK, "put");
+
+    for (auto& deleted : deletes) {
+        deleted = rand() % NUM_KEYS;
+        model.erase(deleted);
+    }
+
+    check(db.del(deletes.data(), deletes.size()) == LSM_OK, "delete");
+}
+
+static void check_tree(Database& db, const map<KEY_t, VAL_t>& model) {
+    map<KEY_t, VAL_t>::const_iterator expected;
+    KEY_t key;
+
+    for (key = 0; key < NUM_KEYS; key++) {
+        auto val = db.get(key);
+
+        check(bool(val) == (model.count(key) > 0), "get found");
+        check(!val || *val == model.at(key), "get value");
+    }
+
+    expected = model.begin();
+
+    for (auto it = db.range(0, NUM_KEYS); it.valid(); it.next(), expected++) {
+        check(expected != model.end() && it.entry().key == expected->first
+              && it.entry().val == expected->second, "range");
+    }
+
+    check(expected == model.end(), "range end");
+}
+
+int main(void) {
+    lsm_options_t options;
+    unique_ptr<Database> db;
+    map<KEY_t, VAL_t> model;
+    int round;
+
+    options.buffer_max_entries = 256;
+    options.depth = 6;
+    options.fanout = 4;
+    options.num_compaction_threads = 4;
+    // Small pages, so that even small runs have the many page
+    // boundaries merges are split at
+    options.page_sizes = {64};
+    options.merge_partition_min_entries = 64;
+    options.cache_size = 0;
+    options.get_parallel_min_pages = 1;
+
+    srand(1);
+
+    for (auto policy : {TIERING, LEVELING, LAZY_LEVELING}) {
+        options.policy = policy;
+        model.clear();
+
+        check(Database::open(options, db) == LSM_OK, "open");
+
+        for (round = 0; round < NUM_ROUNDS; round++) write_round(*db, model);
+
+        check_tree(*db, model);
+        db = nullptr;
+    }
+
+    puts("OK");
+
+    return 0;
+}
@@ -0,0 +1,201 @@
+// Built against the library as test/embed.cpp is. Checks that reads at a
+// snapshot see the tree as it was when the snapshot was taken, however
+// many flushes and merges have run since, both for a snapshot taken
+// between writes and for snapshots taken while a writer runs.
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include "lsm.h"
+
+using namespace std;
+
+#define NUM_KEYS 4000
+#define NUM_ROUNDS 100
+#define NUM_WRITER_ROUNDS 20
+#define NUM_READERS 3
+#define READ_RANGE_KEYS 500
+
+static void check(bool condition, const char *what) {
+    if (!condition) {
+        fprintf(stderr, "snapshot: %s\n", what);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static vector<entry_t> read_range(Database& db, KEY_t start, KEY_t end,
+                                  const Snapshot *snapshot) {
+    vector<entry_t> entries;
+
+    for (auto it = db.range(start, end, snapshot); it.valid(); it.next()) {
+        entries.push_back(it.entry());
+    }
+
+    return entries;
+}
+
+// Check reads at a snapshot against the model of the tree taken with it
+static void check_snapshot(Database& db, const Snapshot *snapshot,
+                           const map<KEY_t, VAL_t>& model) {
+    vector<entry_t> entries;
+    size_t i;
+    KEY_t key;
+
+    for (key = 0; key < NUM_KEYS; key++) {
+        auto val = db.get(key, snapshot);
+
+        check(bool(val) == (model.count(key) > 0), "get found at snapshot");
+        check(!val || *val == model.at(key), "get value at snapshot");
+    }
+
+    entries = read_range(db, 0, NUM_KEYS, snapshot);
+    check(entries.size() == model.size(), "range size at snapshot");
+    i = 0;
+
+    for (const auto& expected : model) {
+        check(entries[i].key == expected.first && entries[i].val == expected.second,
+              "range at snapshot");
+        i++;
+    }
+}
+
+// Write a round of puts and deletes to the tree and the model alike
+static void write_round(Database& db, map<KEY_t, VAL_t>& model) {
+    vector<entry_t> batch(200);
+    vector<KEY_t> deletes(40);
+
+    for (auto& entry : batch) {
+        entry.key = rand() % NUM_KEYS;
+        entry.val = rand() % 100000;
+        model[entry.key] = entry.val;
+    }
+
+    check(db.put(batch.data(), batch.size()) == LSM_OK, "put");
+
+    for (auto& deleted : deletes) {
+        deleted = rand() % NUM_KEYS;
+        model.erase(deleted);
+    }
+
+    check(db.del(deletes.data(), deletes.size()) == LSM_OK, "delete");
+}
+
+/*
+ * Snapshots taken between writes, each checked once later writes have
+ * been flushed and merged past it, and again once the snapshot taken
+ * before it has been let go
+ */
+
+static void check_between_writes(Database& db) {
+    map<KEY_t, VAL_t> model, first_model, second_model;
+    shared_ptr<Snapshot> first, second;
+    int round;
+
+    for (round = 0; round < NUM_ROUNDS; round++) write_round(db, model);
+
+    first = db.snapshot();
+    first_model = model;
+
+    for (round = 0; round < NUM_ROUNDS; round++) write_round(db, model);
+
+    second = db.snapshot();
+    second_model = model;
+
+    for (round = 0; round < NUM_ROUNDS; round++) write_round(db, model);
+
+    check_snapshot(db, first.get(), first_model);
+    check_snapshot(db, second.get(), second_model);
+    check_snapshot(db, nullptr, model);
+
+    first = nullptr;
+
+    for (round = 0; round < NUM_ROUNDS; round++) write_round(db, model);
+
+    check_snapshot(db, second.get(), second_model);
+    check_snapshot(db, nullptr, model);
+}
+
+/*
+ * A writer puts every key in turn, each time with a value higher than
+ * the last, while readers take snapshots. A range read twice at one
+ * snapshot, with writes running in between, must come back the same,
+ * and no key may go back to a lower value at a later snapshot.
+ */
+
+static void check_alongside_writes(Database& db) {
+    vector<thread> readers;
+    atomic<bool> writing;
+    thread writer;
+    int i;
+
+    writing = true;
+
+    writer = thread([&db, &writing] {
+        entry_t entry;
+        int round;
+
+        for (round = 1; round <= NUM_WRITER_ROUNDS; round++) {
+            for (entry.key = 0; entry.key < NUM_KEYS; entry.key++) {
+                entry.val = round;
+                check(db.put(&entry, 1) == LSM_OK, "put alongside reads");
+            }
+        }
+
+        writing = false;
+    });
+
+    for (i = 0; i < NUM_READERS; i++) {
+        readers.emplace_back([&db, &writing, i] {
+            vector<VAL_t> last_vals(READ_RANGE_KEYS, 0);
+            vector<entry_t> first_read, second_read;
+            shared_ptr<Snapshot> snapshot;
+            KEY_t start;
+
+            start = i * READ_RANGE_KEYS;
+
+            while (writing) {
+                snapshot = db.snapshot();
+                first_read = read_range(db, start, start + READ_RANGE_KEYS, snapshot.get());
+                this_thread::yield();
+                second_read = read_range(db, start, start + READ_RANGE_KEYS, snapshot.get());
+
+                check(first_read.size() == second_read.size(), "repeated range size");
+
+                for (size_t j = 0; j < first_read.size(); j++) {
+                    check(first_read[j].key == second_read[j].key
+                          && first_read[j].val == second_read[j].val, "repeated range");
+                    check(first_read[j].val >= last_vals[first_read[j].key - start],
+                          "value went back");
+                    last_vals[first_read[j].key - start] = first_read[j].val;
+                }
+            }
+        });
+    }
+
+    writer.join();
+    for (auto& reader : readers) reader.join();
+}
+
+int main(void) {
+    lsm_options_t options;
+    unique_ptr<Database> db;
+
+    options.buffer_max_entries = 256;
+    options.depth = 6;
+    options.fanout = 4;
+
+    check(Database::open(options, db) == LSM_OK, "open");
+
+    srand(1);
+
+    check_between_writes(*db);
+    check_alongside_writes(*db);
+
+    puts("OK");
+
+    return 0;
+}